@@ -36,15 +36,25 @@ int main()
     scene->obj_add(tall_box);
     scene->obj_add(shot_box);
     scene->build();
+    // scene->build(BVHBuildMethod::BinnedSAH);  /* SAH 构建的 BVH 求交更快，scene->sah_cost() 可以比较树的质量 */
 
     /* 进行渲染 */
-    RTRender::init(scene, 4);
+    RTRender render(scene, 4);
+    // render.integrator.type = IntegratorType::AmbientOcclusion;  /* 快速预览 */
+    // render.train_guiding(5); /* 路径引导，间接光照为主的场景 */
+    // render.cache_enable();   /* 漫反射场景的间接光照缓存 */
+    // render.vpl_build();     /* 虚拟点光源，快速的全局光照近似 */
     auto start = std::chrono::system_clock::now();
-    // RTRender::render_multi_thread(DB_PATH, 8, 400, 100, 500);
-    // RTRender::render_single_thread(DB_PATH);
-    RTRender::render_atomic(DB_PATH);
+    // render.render_multi_thread(DB_PATH, 8, 400, 100, 500);
+    // render.render_single_thread(DB_PATH);
+    // render.render_wavefront();
+    // render.render_progressive(60 * 1000, 0.01f);
+    // render.render_adaptive(16, 256, 0.05f, 16, 8);
+    // render.render_resumable(std::string(RT_RES) + ".checkpoint");  /* 定期保存进度，中断后可以继续 */
+    render.render_atomic(DB_PATH);
+    // render.denoise();
     auto stop = std::chrono::system_clock::now();
-    RTRender::write_to_file(RTRender::framebuffer, RT_RES, scene->screen_width(), scene->screen_height());
+    RTRender::write_to_file(render.framebuffer, RT_RES, scene->screen_width(), scene->screen_height());
 
     /* 统计耗时 */
     fmt::print("\nrender complete\ntime taken: {} hours, {} minutes, {} seconds\n",
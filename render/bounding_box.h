@@ -48,9 +48,20 @@ public:
         return p_max - p_min;
     }
 
+    /* 包围盒的表面积，空的包围盒为 0 */
+    [[nodiscard]] inline float surface_area() const {
+        Eigen::Vector3f d = diagonal();
+        if (d.x() < 0.f || d.y() < 0.f || d.z() < 0.f)
+            return 0.f;
+        return 2.f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
     /* 判断包围盒是否和射线相交 */
     [[nodiscard]] bool isIntersect(const Ray &ray) const;
 
+    /* 判断包围盒是否和线段 [0, t_max) 相交，用于有长度限制的遮挡查询 */
+    [[nodiscard]] bool isIntersect(const Ray &ray, float t_max) const;
+
     /* 包围盒是否包含某个点 */
     [[nodiscard]] bool contain(const Eigen::Vector3f &point) const;
 
@@ -7,6 +7,13 @@
 #include "object.h"
 
 
+/* 构建 BVH 时划分物体的方式 */
+enum class BVHBuildMethod {
+    Median,         /* 沿包围盒最长的轴，在重心的中位数处划分，两侧的物体数量相同 */
+    BinnedSAH,      /* 三个轴向都把重心分到若干个桶中，在桶的边界中选择 SAH 代价最小的划分 */
+};
+
+
 /**
  * BVH 的树节点
  * 叶子节点一定有 object
@@ -15,7 +22,8 @@
 class BVH {
 public:
     /* 根据 obj 的列表构建 BVH 加速结构 */
-    static std::shared_ptr<BVH> build(const std::vector<std::shared_ptr<Object>> &objs);
+    static std::shared_ptr<BVH> build(const std::vector<std::shared_ptr<Object>> &objs,
+                                      BVHBuildMethod method = BVHBuildMethod::Median);
 
     /* 构造函数：创建非叶子节点 */
     BVH(BoundingBox box, float area_, std::shared_ptr<BVH> lchild_, std::shared_ptr<BVH> rchild_)
@@ -23,7 +31,13 @@ public:
               _area(area_),
               _lchild(std::move(lchild_)),
               _rchild(std::move(rchild_)),
-              _object(nullptr) {}
+              _object(nullptr) {
+        /* 光线穿过父节点时，穿过子节点的条件概率是两者表面积之比；退化为平面或点的包围盒按概率为 1 计算 */
+        float sa = _box.surface_area();
+        float l  = sa > 0.f ? _lchild->_box.surface_area() / sa : 1.f;
+        float r  = sa > 0.f ? _rchild->_box.surface_area() / sa : 1.f;
+        _sah_cost = SAH_TRAVERSAL_COST + l * _lchild->_sah_cost + r * _rchild->_sah_cost;
+    }
 
     /* 构造函数：创建叶子节点 */
     BVH(BoundingBox box, float area_, std::shared_ptr<Object> obj)
@@ -31,21 +45,55 @@ public:
               _area(area_),
               _lchild(nullptr),
               _rchild(nullptr),
-              _object(std::move(obj)) {}
+              _object(std::move(obj)),
+              _sah_cost(_object->intersect_cost()) {}
 
     /* 计算 BVH 内的物体和光线的交点 */
     [[nodiscard]] Intersection intersect(const Ray &ray) const;
 
+    /**
+     * 光线在 (0, t_max) 范围内是否和 BVH 内的物体相交，用于 shadow ray
+     * 找到任意一个遮挡物就停止遍历，不需要比较左右子树的交点，也不会构造 Intersection
+     */
+    [[nodiscard]] bool occluded(const Ray &ray, float t_max) const;
+
+    /**
+     * 计算 BVH 内的物体和光线包的交点，只计算 mask 中的光线，更近的交点会写入 hit
+     * 光线包整体遍历 BVH，某个节点上所有光线都不相交时才会跳过该节点
+     */
+    template<int N_>
+    void intersect(const RayPacket<N_> &packet, uint32_t mask, PacketHit<N_> &hit) const;
+
     /* 按照面积在 BVH 中随机的采样 */
     Intersection sample_obj(float area_threshold);
 
+    /* 访问一个非叶子节点（和包围盒求交）的代价，以和一个三角形求交的代价为单位 */
+    static inline const float SAH_TRAVERSAL_COST = 0.125f;
+
+    /* BinnedSAH 每个轴向的桶的数量 */
+    static inline const int SAH_BIN_CNT = 16;
+
 
 private:
+    /* 在重心的中位数处划分，返回 [左侧的物体，右侧的物体] */
+    static std::pair<std::vector<std::shared_ptr<Object>>, std::vector<std::shared_ptr<Object>>>
+    _split_median(const std::vector<std::shared_ptr<Object>> &objs, const BoundingBox &box);
+
+    /**
+     * 分桶的 SAH 划分，返回 [左侧的物体，右侧的物体]
+     * 划分的代价为 SA(左) * C(左) + SA(右) * C(右)，C 是一侧所有物体 intersect_cost 的和：
+     * 含有大量三角形的模型比单个三角形的代价高，划分时会被单独隔离出来
+     * 所有物体的重心重合、无法按桶划分时，退化为中位数划分
+     */
+    static std::pair<std::vector<std::shared_ptr<Object>>, std::vector<std::shared_ptr<Object>>>
+    _split_sah(const std::vector<std::shared_ptr<Object>> &objs, const BoundingBox &box);
+
     BoundingBox _box;                   /* 以当前节点为树根，BVH 树的包围盒 */
     float _area;                        /* BVH 中所有对象的表面积 */
     std::shared_ptr<BVH> _lchild;
     std::shared_ptr<BVH> _rchild;
     std::shared_ptr<Object> _object;    /* 当前节点包含的对象，只有叶子节点才有 */
+    float _sah_cost;                    /* 以当前节点为树根的 SAH 代价 */
 
 public:
     // 属性
@@ -60,6 +108,13 @@ public:
     [[nodiscard]] inline const BoundingBox &bounding_box() const { return _box; }
 
     [[nodiscard]] inline const float &area() const { return _area; }
+
+    /**
+     * 树的 SAH 代价：一根穿过根节点包围盒的光线，期望的求交代价
+     * 叶子是物体的 intersect_cost，非叶子是 SAH_TRAVERSAL_COST 加上两个子节点按照表面积之比加权的代价
+     * 用于比较不同构建方式得到的树，越小越好
+     */
+    [[nodiscard]] inline float sah_cost() const { return _sah_cost; }
 };
 
 
@@ -0,0 +1,59 @@
+#ifndef RENDER_DEBUG_DENOISER_H
+#define RENDER_DEBUG_DENOISER_H
+
+#include <vector>
+#include <cassert>
+
+#include <Eigen/Eigen>
+
+
+/**
+ * 降噪使用的辅助缓冲（AOV），来自摄像机光线的第一个交点
+ * 像素的排列和 framebuffer 相同：先行后列，从左上角开始；没有交点的像素，所有的值都是 0
+ */
+struct AOVBuffer {
+    int width = 0, height = 0;
+    std::vector<Eigen::Vector3f> albedo;    /* 材质的反射率 */
+    std::vector<Eigen::Vector3f> normal;    /* 交点的法线 */
+    std::vector<float> depth;               /* 摄像机到交点的距离 */
+
+    AOVBuffer() = default;
+
+    AOVBuffer(int width, int height)
+            : width(width), height(height),
+              albedo((size_t) width * height, Eigen::Vector3f::Zero()),
+              normal((size_t) width * height, Eigen::Vector3f::Zero()),
+              depth((size_t) width * height, 0.f) {
+        assert(width > 0 && height > 0);
+    }
+};
+
+
+/**
+ * 基于 AOV 的边缘保持降噪：À-Trous 小波滤波
+ *  - 每一轮使用 5x5 的 B3 样条核，采样点的间隔为 2^i，几轮之后就能覆盖很大的范围
+ *  - 相邻像素的权重由颜色、法线、反射率、深度的差异共同决定，几何和材质的边缘不会被模糊
+ * 参考：Dammertz et al. 2010, Edge-Avoiding À-Trous Wavelet Transform for fast Global Illumination Filtering
+ */
+class Denoiser {
+public:
+    struct Options {
+        int iterations = 5;         /* 滤波的轮数，覆盖的半径约为 2^(iterations + 1) 个像素 */
+        float sigma_color = 0.3f;   /* 颜色差异的容忍度，颜色先经过 c / (1 + c) 的映射；采样间隔加倍时减半 */
+        float sigma_normal = 0.3f;  /* 法线差异的容忍度 */
+        float sigma_albedo = 0.1f;  /* 反射率差异的容忍度 */
+        float sigma_depth = 0.05f;  /* 深度差异的容忍度，相对于当前像素的深度 */
+        int tile_size = 32;         /* 每个线程一次处理一个区块 */
+    };
+
+    /**
+     * 对 radiance 进行降噪，返回降噪之后的结果
+     * @param color 像素的 radiance，没有经过 gamma 矫正
+     * @param thread_cnt 使用的线程数量
+     */
+    static std::vector<Eigen::Vector3f> atrous(const std::vector<Eigen::Vector3f> &color, const AOVBuffer &aov,
+                                               const Options &options, unsigned thread_cnt);
+};
+
+
+#endif //RENDER_DEBUG_DENOISER_H
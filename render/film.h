@@ -0,0 +1,140 @@
+#ifndef RENDER_DEBUG_FILM_H
+#define RENDER_DEBUG_FILM_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cassert>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+#include <Eigen/Eigen>
+
+#include "utils.h"
+
+
+/**
+ * 浮点的累积缓冲，记录每个像素所有采样的 radiance 之和
+ * 同时使用 Welford 算法在线地统计每个像素亮度的均值和方差，用来估计像素的噪声
+ * 像素的排列和 framebuffer 相同：先行后列，从左上角开始
+ */
+class Film {
+public:
+    /* 一个像素的累积信息 */
+    struct Pixel {
+        Eigen::Vector3f sum{0.f, 0.f, 0.f};     /* 所有采样的 radiance 之和 */
+        int spp = 0;                            /* 已经累积的采样数量 */
+        float mean = 0.f;                       /* 亮度的均值 */
+        float m2 = 0.f;                         /* 亮度与均值之差的平方和 */
+
+        /* 累积一个采样 */
+        inline void add(const Eigen::Vector3f &radiance) {
+            sum += radiance;
+            ++spp;
+            float lum   = luminance(radiance);
+            float delta = lum - mean;
+            mean += delta / (float) spp;
+            m2 += delta * (lum - mean);
+        }
+
+        /* 像素的 radiance：所有采样的均值 */
+        [[nodiscard]] inline Eigen::Vector3f radiance() const {
+            return spp > 0 ? Eigen::Vector3f(sum / (float) spp) : Eigen::Vector3f(0.f, 0.f, 0.f);
+        }
+
+        /* 亮度的样本方差，采样数不足 2 个时无法估计，返回无穷大 */
+        [[nodiscard]] inline float variance() const {
+            return spp > 1 ? m2 / (float) (spp - 1) : std::numeric_limits<float>::infinity();
+        }
+
+        /* 像素的噪声：亮度均值的标准误差 */
+        [[nodiscard]] inline float std_error() const { return std::sqrt(variance() / (float) spp); }
+
+        /* 相对误差：标准误差和亮度均值之比，分母加上一个常数，避免暗处的像素误差过大 */
+        [[nodiscard]] inline float relative_error() const { return std_error() / (mean + 0.01f); }
+    };
+
+    Film() = default;
+
+    Film(int width, int height)
+            : _width(width), _height(height), _pixels((size_t) width * height) {
+        assert(width > 0 && height > 0);
+    }
+
+    /* 清空所有的累积信息 */
+    inline void clear() { std::fill(_pixels.begin(), _pixels.end(), Pixel()); }
+
+    [[nodiscard]] inline Pixel &at(int row, int col) { return _pixels[row * _width + col]; }
+
+    [[nodiscard]] inline const Pixel &at(int row, int col) const { return _pixels[row * _width + col]; }
+
+    /* 以二进制写入宽、高和所有像素的累积信息，用于保存渲染的进度 */
+    void write(std::ostream &os) const {
+        _write_pod(os, _width);
+        _write_pod(os, _height);
+        for (auto &pixel : _pixels) {
+            _write_pod(os, pixel.sum.x());
+            _write_pod(os, pixel.sum.y());
+            _write_pod(os, pixel.sum.z());
+            _write_pod(os, pixel.spp);
+            _write_pod(os, pixel.mean);
+            _write_pod(os, pixel.m2);
+        }
+    }
+
+    /* 读取 write 写入的内容，替换当前的累积信息；内容不完整时抛出异常 */
+    void read(std::istream &is) {
+        int width = 0, height = 0;
+        _read_pod(is, width);
+        _read_pod(is, height);
+        if (width <= 0 || height <= 0)
+            throw std::runtime_error("invalid film size");
+
+        std::vector<Pixel> pixels((size_t) width * height);
+        for (auto &pixel : pixels) {
+            _read_pod(is, pixel.sum.x());
+            _read_pod(is, pixel.sum.y());
+            _read_pod(is, pixel.sum.z());
+            _read_pod(is, pixel.spp);
+            _read_pod(is, pixel.mean);
+            _read_pod(is, pixel.m2);
+        }
+        _width = width;
+        _height = height;
+        _pixels.swap(pixels);
+    }
+
+    /* 所有像素中最大的噪声 */
+    [[nodiscard]] inline float max_std_error() const {
+        float res = 0.f;
+        for (auto &pixel : _pixels)
+            res = std::max(res, pixel.std_error());
+        return res;
+    }
+
+private:
+    template<class T_>
+    static void _write_pod(std::ostream &os, const T_ &value) {
+        os.write(reinterpret_cast<const char *>(&value), sizeof(T_));
+    }
+
+    template<class T_>
+    static void _read_pod(std::istream &is, T_ &value) {
+        if (!is.read(reinterpret_cast<char *>(&value), sizeof(T_)))
+            throw std::runtime_error("unexpected end of film data");
+    }
+
+    int _width = 0, _height = 0;
+    std::vector<Pixel> _pixels;
+
+public:
+    [[nodiscard]] inline int width() const { return _width; }
+
+    [[nodiscard]] inline int height() const { return _height; }
+
+    [[nodiscard]] inline const std::vector<Pixel> &pixels() const { return _pixels; }
+};
+
+
+#endif //RENDER_DEBUG_FILM_H
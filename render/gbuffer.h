@@ -0,0 +1,80 @@
+#ifndef RENDER_DEBUG_GBUFFER_H
+#define RENDER_DEBUG_GBUFFER_H
+
+#include <cmath>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "intersection.h"
+
+
+/**
+ * 主光线的 G-buffer：摄像机光线与场景的第一个交点（位置、法线、材质、图元）
+ * 每个像素有 offset_cnt 个固定的子像素偏移，每个偏移缓存一个交点，像素的第 i 个采样使用第 i % offset_cnt 个偏移
+ * 同一个像素的所有采样都从缓存的交点出发，不需要重复遍历 BVH
+ * 像素的排列和 framebuffer 相同：先行后列，从左上角开始
+ */
+class GBuffer {
+public:
+    GBuffer() = default;
+
+    GBuffer(int width, int height, int offset_cnt)
+            : _width(width), _height(height), _offset_cnt(offset_cnt),
+              _hits((size_t) width * height * offset_cnt),
+              _ready((size_t) width * height, 0) {
+        assert(width > 0 && height > 0 && offset_cnt > 0);
+    }
+
+    /* 像素 (col, row) 第 offset 个子像素偏移的交点 */
+    inline Intersection &at(int row, int col, int offset) {
+        assert(row >= 0 && row < _height && col >= 0 && col < _width && offset >= 0 && offset < _offset_cnt);
+        return _hits[((size_t) row * _width + col) * _offset_cnt + offset];
+    }
+
+    [[nodiscard]] inline const Intersection &at(int row, int col, int offset) const {
+        assert(row >= 0 && row < _height && col >= 0 && col < _width && offset >= 0 && offset < _offset_cnt);
+        return _hits[((size_t) row * _width + col) * _offset_cnt + offset];
+    }
+
+    /* 像素的所有交点是否已经计算过了 */
+    [[nodiscard]] inline bool ready(int row, int col) const {
+        return row >= 0 && row < _height && col >= 0 && col < _width && _ready[(size_t) row * _width + col];
+    }
+
+    inline void set_ready(int row, int col) { _ready[(size_t) row * _width + col] = 1; }
+
+    /* 像素的第 sample 个采样使用的子像素偏移 */
+    [[nodiscard]] inline int offset_of(int sample) const { return sample % _offset_cnt; }
+
+    /**
+     * 第 k 个子像素偏移，范围是 [0, 1)^2
+     * 使用 R2 低差异序列，任意个数的偏移都能比较均匀地覆盖像素；第 0 个偏移是像素的中心
+     */
+    static inline Eigen::Vector2f jitter_offset(int k) {
+        constexpr double a1 = 0.7548776662466927;   /* 1 / g，g 是 x^3 = x + 1 的实根 */
+        constexpr double a2 = 0.5698402909980532;   /* 1 / g^2 */
+        double x = 0.5 + a1 * k;
+        double y = 0.5 + a2 * k;
+        return {(float) (x - std::floor(x)), (float) (y - std::floor(y))};
+    }
+
+    [[nodiscard]] inline int width() const { return _width; }
+
+    [[nodiscard]] inline int height() const { return _height; }
+
+    [[nodiscard]] inline int offset_cnt() const { return _offset_cnt; }
+
+    [[nodiscard]] inline bool empty() const { return _hits.empty(); }
+
+private:
+    int _width = 0, _height = 0;
+    int _offset_cnt = 1;
+    std::vector<Intersection> _hits;            /* 每个像素的 offset_cnt 个交点 */
+    std::vector<uint8_t> _ready;                /* 每个像素的交点是否已经计算过 */
+};
+
+
+#endif //RENDER_DEBUG_GBUFFER_H
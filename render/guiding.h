@@ -0,0 +1,173 @@
+#ifndef RENDER_DEBUG_GUIDING_H
+#define RENDER_DEBUG_GUIDING_H
+
+#include <array>
+#include <tuple>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "ray.h"
+#include "utils.h"
+#include "bounding_box.h"
+
+
+/**
+ * 球面上的方向和 [0, 1)^2 之间的等面积映射（圆柱投影）
+ *  x = (cos_theta + 1) / 2，y = phi / 2pi
+ * 正方形上的均匀分布对应球面上的均匀分布，因此正方形上的概率密度 p 对应球面上的 p / 4pi
+ */
+Eigen::Vector2f dir_to_canonical(const Direction &dir);
+
+Direction canonical_to_dir(const Eigen::Vector2f &p);
+
+
+/**
+ * 方向的四叉树：统计到达空间中某个区域的 radiance 在各个方向上的分布
+ * 每个节点将正方形等分为 4 个象限，记录每个象限的能量；能量集中的象限会被继续细分
+ * 记录是无锁的，多个线程可以同时调用 record
+ * 能量以定点数累加：整数加法满足结合律，记录的结果和线程的调度顺序无关，训练得到的分布是确定的
+ */
+class DTree {
+public:
+    DTree() : _nodes(1) {}
+
+    DTree(const DTree &other);
+
+    DTree &operator=(const DTree &other);
+
+    /* 在方向 p（[0, 1)^2 上的点）记录能量 value，线程安全 */
+    void record(const Eigen::Vector2f &p, float value);
+
+    /* 按照记录的能量分布采样，返回 [0, 1)^2 上的点；没有能量时均匀采样 */
+    [[nodiscard]] Eigen::Vector2f sample() const;
+
+    /* [0, 1)^2 上的概率密度；没有能量时是均匀分布，密度为 1 */
+    [[nodiscard]] float pdf(const Eigen::Vector2f &p) const;
+
+    /* 记录的总能量 */
+    [[nodiscard]] inline float total() const { return _node_total(_nodes[0]); }
+
+    /* 记录的次数，包括能量为 0 的记录 */
+    [[nodiscard]] inline uint32_t record_cnt() const { return _record_cnt.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] inline size_t node_cnt() const { return _nodes.size(); }
+
+    /**
+     * 根据记录的能量分布生成新的树结构，新的树没有记录
+     * 能量占比超过 energy_threshold 的象限会被细分，直到 max_depth；占比很小的子树会被合并
+     */
+    [[nodiscard]] DTree refined(float energy_threshold, int max_depth) const;
+
+private:
+    struct Node {
+        std::array<uint32_t, 4> child{};            /* 子节点的索引，0 表示这个象限没有细分 */
+        std::array<std::atomic<uint64_t>, 4> sum{}; /* 每个象限记录的能量，定点数 */
+
+        Node() = default;
+
+        Node(const Node &other) : child(other.child) {
+            for (int i = 0; i < 4; ++i)
+                sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    };
+
+    /* 定点数的缩放：能量的分辨率是 1 / FIXED_SCALE；单次记录的能量不超过 MAX_VALUE，防止溢出 */
+    static inline const float FIXED_SCALE = 65536.f;
+    static inline const float MAX_VALUE   = 4294967296.f;
+
+    /* 象限 q 记录的能量 */
+    static inline float _sum(const Node &node, int q) {
+        return (float) node.sum[q].load(std::memory_order_relaxed) / FIXED_SCALE;
+    }
+
+    static inline float _node_total(const Node &node) {
+        uint64_t total = 0;
+        for (auto &s : node.sum)
+            total += s.load(std::memory_order_relaxed);
+        return (float) total / FIXED_SCALE;
+    }
+
+    /* 将 p 映射到所在的象限，返回象限的序号，p 变为象限内的坐标 */
+    static inline int _quadrant(Eigen::Vector2f &p) {
+        int qx = p.x() >= 0.5f, qy = p.y() >= 0.5f;
+        p = Eigen::Vector2f(p.x() * 2.f - (float) qx, p.y() * 2.f - (float) qy);
+        return qx + 2 * qy;
+    }
+
+    /**
+     * 构造新的树结构时，处理一个节点
+     * @param src 原来的树中对应的节点，-1 表示原来的树在这里没有细分
+     * @param energy 四个象限的能量，以整棵树的总能量归一化
+     */
+    void _build(DTree &dst, uint32_t dst_idx, int src, const std::array<float, 4> &energy, int depth,
+                float energy_threshold, int max_depth) const;
+
+    std::vector<Node> _nodes;                   /* 第一个节点是根节点 */
+    std::atomic<uint32_t> _record_cnt{0};
+};
+
+
+/**
+ * 路径引导：在线学习场景中的 radiance 分布，按照它来采样间接光照的方向
+ * 空间上是覆盖场景包围盒的二叉树（轴向依次为 x, y, z），每个叶子有两棵方向四叉树：
+ *  - sampling：上一轮训练得到的分布，用于采样和计算 pdf，训练期间只读
+ *  - building：这一轮训练正在记录的分布，多个线程无锁地写入
+ * 每一轮训练结束后调用 refine：记录数量过多的空间叶子一分为二，building 变为新的 sampling
+ * 参考：Müller et al. 2017, Practical Path Guiding for Efficient Light-Transport Simulation
+ */
+class PathGuiding {
+public:
+    struct Options {
+        float bsdf_fraction = 0.5f;         /* one-sample MIS 中使用 BSDF 采样的概率 */
+        uint32_t spatial_threshold = 4000;  /* 空间叶子一轮记录的数量超过这个值就一分为二 */
+        float energy_threshold = 0.01f;     /* 方向四叉树中能量占比超过这个值的象限会被继续细分 */
+        int max_depth = 16;                 /* 方向四叉树的最大深度 */
+    };
+
+    PathGuiding(const BoundingBox &bounds, const Options &options);
+
+    /* 记录位置 pos 处，从方向 wi 到达的 radiance（已经除以采样的 pdf），线程安全 */
+    void record(const Eigen::Vector3f &pos, const Direction &wi, float value);
+
+    /* 在位置 pos 处按照学习到的分布采样一个方向，返回方向和立体角上的 pdf */
+    [[nodiscard]] std::tuple<Direction, float> sample(const Eigen::Vector3f &pos) const;
+
+    /* 在位置 pos 处采样到方向 wi 的 pdf（立体角） */
+    [[nodiscard]] float pdf(const Eigen::Vector3f &pos, const Direction &wi) const;
+
+    /* 一轮训练结束：细分空间，并用这一轮的记录作为之后采样的分布；不能和 record 同时调用 */
+    void refine();
+
+    /* 是否已经完成过至少一轮训练，可以用于采样 */
+    [[nodiscard]] inline bool trained() const { return _iteration > 0; }
+
+    [[nodiscard]] inline const Options &options() const { return _options; }
+
+    [[nodiscard]] inline size_t leaf_cnt() const { return _leaves.size(); }
+
+private:
+    struct SNode {
+        int axis = 0;                       /* 划分的轴向 */
+        std::array<uint32_t, 2> child{};    /* 子节点的索引，0 表示这是叶子 */
+        uint32_t leaf = 0;                  /* 是叶子时，在 _leaves 中的索引 */
+    };
+
+    struct Leaf {
+        DTree sampling, building;
+    };
+
+    /* 位置 pos 所在的空间叶子 */
+    [[nodiscard]] uint32_t _leaf_of(const Eigen::Vector3f &pos) const;
+
+    Options _options;
+    BoundingBox _bounds;
+    std::vector<SNode> _nodes;
+    std::vector<Leaf> _leaves;
+    int _iteration = 0;
+};
+
+
+#endif //RENDER_DEBUG_GUIDING_H
@@ -9,6 +9,8 @@
 #include "ray.h"
 #include "material.h"
 
+class Object;
+
 
 /* 射线和物体发生相交，交点的信息 */
 class Intersection {
@@ -25,15 +27,18 @@ public:
               _position(0.f, 0.f, 0.f),
               _normal(),
               _t_near(-1.f),
-              _mat(nullptr) {}
+              _mat(nullptr),
+              _obj(nullptr) {}
 
-    /* 构造函数：有相交的情况 */
-    Intersection(Eigen::Vector3f position, Direction normal, float t_near_, std::shared_ptr<Material> mat)
+    /* 构造函数：有相交的情况，obj 是发生相交的图元 */
+    Intersection(Eigen::Vector3f position, Direction normal, float t_near_, std::shared_ptr<Material> mat,
+                 const Object *obj = nullptr)
             : _happened(true),
               _position(std::move(position)),
               _normal(std::move(normal)),
               _t_near(t_near_),
-              _mat(std::move(mat)) {}
+              _mat(std::move(mat)),
+              _obj(obj) {}
 
 
 private:
@@ -42,6 +47,7 @@ private:
     Direction _normal;                      /* 交点的法线 */
     float _t_near;                          /* 光线起点到交点的距离 */
     std::shared_ptr<Material> _mat;         /* 发生相交时，物体的材质 */
+    const Object *_obj;                     /* 发生相交的图元（三角形），可以作为图元的 id */
 
 
 public:
@@ -57,6 +63,8 @@ public:
 
     [[nodiscard]] inline std::shared_ptr<Material> mat() const { return _mat; }
 
+    [[nodiscard]] inline const Object *obj() const { return _obj; }
+
 };
 
 #endif //RENDER_DEBUG_INTERSECTION_H
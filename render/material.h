@@ -28,6 +28,13 @@ public:
         Diffuse, Emission,
     };
 
+    /* BSDF 采样的结果：入射方向，该方向的概率密度，以及 BSDF 的值 */
+    struct BSDFSample {
+        Direction wi;
+        float pdf = 0.f;
+        Eigen::Vector3f f{0.f, 0.f, 0.f};
+    };
+
     /* 工厂函数：创建一个灰色的漫反射材质 */
     static inline std::shared_ptr<Material> diffuse_mat() {
         return std::make_shared<Material>();
@@ -83,6 +90,19 @@ public:
         return _diffuse / M_PI;
     }
 
+    /**
+     * 根据材质的 BSDF 对入射方向进行重要性采样
+     *  - 漫反射：按照余弦加权在半球内采样
+     *  - 发光体：不会反射光线，pdf 为 0
+     * 新增的材质类型在这里选择自己的采样方式
+     * @param wo 出射方向，从交点指向外面
+     * @param N 表面的法线
+     */
+    [[nodiscard]] BSDFSample sample(const Direction &wo, const Direction &N) const;
+
+    /* sample 采样得到入射方向 wi 的概率密度（立体角测度） */
+    [[nodiscard]] float pdf(const Direction &wi, const Direction &wo, const Direction &N) const;
+
     /* BRDF：micro surface shading */
     Eigen::Vector3f brdf_ms(const Direction &wi, const Direction &wo, const Direction &N) {
         return {};
@@ -95,6 +115,13 @@ public:
      */
     static std::tuple<float, Direction> sample_himsphere_random(const Direction &N);
 
+    /**
+     * 按照余弦加权，在半球内采样
+     * @param N 采样表面的法线方向
+     * @return [pdf，方向]
+     */
+    static std::tuple<float, Direction> sample_himsphere_cosine(const Direction &N);
+
     /**
      * 将 local 坐标转换为 global 坐标
      * @param N local 坐标系由 N 定义
@@ -113,8 +140,15 @@ private:
 public:
     [[nodiscard]] inline bool is_emission() const { return _is_emission; }
 
+    [[nodiscard]] inline bool is_diffuse() const { return _mat_type == MaterialType::Diffuse; }
+
     [[nodiscard]] inline Eigen::Vector3f emission() const { return _emission; }
 
+    /* 反射率：漫反射的颜色值，发光体不反射光线，反射率为 0 */
+    [[nodiscard]] inline Eigen::Vector3f albedo() const {
+        return _is_emission ? Eigen::Vector3f(0.f, 0.f, 0.f) : _diffuse;
+    }
+
 };
 
 #endif //RENDER_DEBUG_METERIAL_H
@@ -7,6 +7,7 @@
 #include "material.h"
 #include "bounding_box.h"
 #include "intersection.h"
+#include "ray_packet.h"
 
 
 class Object {
@@ -22,12 +23,53 @@ public:
     /* 计算光线和当前物体的交点 */
     virtual Intersection intersect(const Ray &ray) = 0;
 
+    /**
+     * 光线在 (0, t_max) 范围内是否和物体相交，找到任意一个交点就可以返回
+     * 不需要最近的交点，也不会构造 Intersection；默认实现是调用 intersect
+     */
+    virtual bool occluded(const Ray &ray, float t_max) {
+        Intersection inter = intersect(ray);
+        return inter.happened() && inter.t_near() < t_max;
+    }
+
     /**
      * 对物体随机采样
      * @param area_threshold 面积阈值的参考值
      */
     virtual Intersection obj_sample(float area_threshold) = 0;
 
+    /**
+     * 计算光线包和当前物体的交点，只计算 mask 中的光线
+     * 交点比 hit 中记录的更近时，才会写入 hit；默认实现是逐根光线调用 intersect
+     */
+    virtual void intersect_packet(const RayPacket<4> &packet, uint32_t mask, PacketHit<4> &hit) {
+        _intersect_each(packet, mask, hit);
+    }
+
+    virtual void intersect_packet(const RayPacket<8> &packet, uint32_t mask, PacketHit<8> &hit) {
+        _intersect_each(packet, mask, hit);
+    }
+
+    /**
+     * 光线和物体求交的代价，以和一个三角形求交的代价为单位，用于构建 BVH 时的 SAH
+     * 默认是一个基本图元；由多个图元组成的物体应该返回内部加速结构的代价
+     */
+    [[nodiscard]] virtual float intersect_cost() const { return 1.f; }
+
+protected:
+    /* 逐根光线计算光线包的交点 */
+    template<int N_>
+    void _intersect_each(const RayPacket<N_> &packet, uint32_t mask, PacketHit<N_> &hit) {
+        for (int i = 0; i < N_; ++i) {
+            if (!(mask >> i & 1u)) continue;
+            Intersection inter = intersect(packet.ray(i));
+            if (inter.happened() && inter.t_near() < hit.t[i]) {
+                hit.t[i] = inter.t_near();
+                hit.inter[i] = inter;
+            }
+        }
+    }
+
 protected:
     BoundingBox _bounding_box;                  /* 物体的包围盒 */
     float _area;                                /* 物体的总面积 */
@@ -0,0 +1,78 @@
+#ifndef RENDER_DEBUG_RADIANCE_CACHE_H
+#define RENDER_DEBUG_RADIANCE_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "ray.h"
+#include "bounding_box.h"
+
+
+/**
+ * 世界空间的 radiance 缓存：哈希网格，以位置所在的网格和量化之后的法线作为键
+ * 每个条目累积落在其中的漫反射表面点的出射 radiance（漫反射的出射 radiance 和方向无关）
+ *  - 插入是无锁的：开放寻址的哈希表，通过 CAS 占用空的条目，多个线程可以同时插入
+ *  - 条目的样本数达到 min_count，并且均值的相对标准误差低于 max_error 之后，才可以用于查询
+ * 哈希表满了之后，新的位置不会被缓存
+ */
+class RadianceCache {
+public:
+    struct Options {
+        float cell_size = 0.f;          /* 网格的边长，<= 0 表示场景包围盒对角线长度的 1/64 */
+        int normal_resolution = 2;      /* 法线每个分量量化为 2 * normal_resolution + 1 个等级 */
+        uint32_t min_count = 64;        /* 条目可以用于查询的最少样本数 */
+        float max_error = 0.1f;         /* 条目可以用于查询的最大相对标准误差（亮度） */
+        int min_depth = 2;              /* 路径的第几个节点开始查询缓存，2 表示从第二个交点开始 */
+        size_t capacity = 1 << 18;      /* 哈希表的条目数量，会向上取整为 2 的幂 */
+    };
+
+    RadianceCache(const BoundingBox &bounds, const Options &options);
+
+    /* 记录位置 pos（表面法线为 N）的一个出射 radiance 样本，线程安全 */
+    void insert(const Eigen::Vector3f &pos, const Direction &N, const Eigen::Vector3f &Lo);
+
+    /**
+     * 查询位置 pos 的出射 radiance
+     * @param [out]Lo 条目满足误差要求时，写入条目的均值
+     * @return 条目是否满足误差要求
+     */
+    bool query(const Eigen::Vector3f &pos, const Direction &N, Eigen::Vector3f &Lo) const;
+
+    [[nodiscard]] inline const Options &options() const { return _options; }
+
+    /* 已经被占用的条目数量 */
+    [[nodiscard]] size_t entry_cnt() const;
+
+    /* 满足误差要求、可以用于查询的条目数量 */
+    [[nodiscard]] size_t valid_cnt() const;
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> key{0};                   /* 0 表示空的条目 */
+        std::atomic<float> sum[3]{};                    /* radiance 的和 */
+        std::atomic<float> sum_lum2{0.f};               /* 亮度平方的和，用于估计误差 */
+        std::atomic<uint32_t> count{0};
+    };
+
+    /* 位置和法线对应的键，不会是 0 */
+    [[nodiscard]] uint64_t _key_of(const Eigen::Vector3f &pos, const Direction &N) const;
+
+    /* 查找键对应的条目，insert 为 true 时占用空的条目；找不到时返回 nullptr */
+    Entry *_find(uint64_t key, bool insert) const;
+
+    /* 条目是否满足误差要求 */
+    [[nodiscard]] bool _valid(const Entry &entry, Eigen::Vector3f *mean) const;
+
+    static inline const int MAX_PROBE = 16;   /* 开放寻址时最多探测的条目数量 */
+
+    Options _options;
+    float _inv_cell_size;
+    size_t _mask;
+    std::unique_ptr<Entry[]> _entries;
+};
+
+
+#endif //RENDER_DEBUG_RADIANCE_CACHE_H
@@ -0,0 +1,246 @@
+#ifndef RENDER_DEBUG_RAY_PACKET_H
+#define RENDER_DEBUG_RAY_PACKET_H
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+
+#include <Eigen/Eigen>
+
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "ray.h"
+#include "bounding_box.h"
+#include "intersection.h"
+
+
+/* 默认的光线包宽度：开启 AVX 时一次处理 8 根光线，否则 4 根 */
+#if defined(__AVX__)
+constexpr int RAY_PACKET_WIDTH = 8;
+#else
+constexpr int RAY_PACKET_WIDTH = 4;
+#endif
+
+
+// =========================================================
+// 光线包的一个分量：N 根光线的同一个 float 值
+// SSE 和 AVX 分别特化 4 路和 8 路，其他平台使用逐个元素计算的通用实现
+// 比较运算返回位掩码，第 i 位表示第 i 根光线的结果
+// =========================================================
+template<int N_>
+struct PacketFloat {
+    std::array<float, N_> v;
+
+    static inline PacketFloat load(const float *p) {
+        PacketFloat res;
+        std::copy(p, p + N_, res.v.begin());
+        return res;
+    }
+
+    static inline PacketFloat broadcast(float x) {
+        PacketFloat res;
+        res.v.fill(x);
+        return res;
+    }
+
+    inline void store(float *p) const { std::copy(v.begin(), v.end(), p); }
+};
+
+#define PACKET_FLOAT_GENERIC_OP(name, expr)                                                                    \
+    template<int N_>                                                                                           \
+    inline PacketFloat<N_> name(const PacketFloat<N_> &a, const PacketFloat<N_> &b) {                          \
+        PacketFloat<N_> res;                                                                                   \
+        for (int i = 0; i < N_; ++i) res.v[i] = (expr);                                                       \
+        return res;                                                                                            \
+    }
+
+PACKET_FLOAT_GENERIC_OP(operator+, a.v[i] + b.v[i])
+PACKET_FLOAT_GENERIC_OP(operator-, a.v[i] - b.v[i])
+PACKET_FLOAT_GENERIC_OP(operator*, a.v[i] * b.v[i])
+PACKET_FLOAT_GENERIC_OP(operator/, a.v[i] / b.v[i])
+PACKET_FLOAT_GENERIC_OP(packet_min, std::min(a.v[i], b.v[i]))
+PACKET_FLOAT_GENERIC_OP(packet_max, std::max(a.v[i], b.v[i]))
+#undef PACKET_FLOAT_GENERIC_OP
+
+template<int N_>
+inline PacketFloat<N_> packet_abs(const PacketFloat<N_> &a) {
+    PacketFloat<N_> res;
+    for (int i = 0; i < N_; ++i) res.v[i] = std::abs(a.v[i]);
+    return res;
+}
+
+#define PACKET_FLOAT_GENERIC_CMP(name, op)                                                                     \
+    template<int N_>                                                                                           \
+    inline uint32_t name(const PacketFloat<N_> &a, const PacketFloat<N_> &b) {                                 \
+        uint32_t mask = 0;                                                                                     \
+        for (int i = 0; i < N_; ++i) mask |= (a.v[i] op b.v[i] ? 1u : 0u) << i;                               \
+        return mask;                                                                                           \
+    }
+
+PACKET_FLOAT_GENERIC_CMP(lanes_lt, <)
+PACKET_FLOAT_GENERIC_CMP(lanes_le, <=)
+PACKET_FLOAT_GENERIC_CMP(lanes_gt, >)
+PACKET_FLOAT_GENERIC_CMP(lanes_ge, >=)
+#undef PACKET_FLOAT_GENERIC_CMP
+
+
+#if defined(__SSE__)
+template<>
+struct PacketFloat<4> {
+    __m128 v;
+
+    static inline PacketFloat load(const float *p) { return {_mm_load_ps(p)}; }
+
+    static inline PacketFloat broadcast(float x) { return {_mm_set1_ps(x)}; }
+
+    inline void store(float *p) const { _mm_store_ps(p, v); }
+};
+
+inline PacketFloat<4> operator+(PacketFloat<4> a, PacketFloat<4> b) { return {_mm_add_ps(a.v, b.v)}; }
+inline PacketFloat<4> operator-(PacketFloat<4> a, PacketFloat<4> b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline PacketFloat<4> operator*(PacketFloat<4> a, PacketFloat<4> b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline PacketFloat<4> operator/(PacketFloat<4> a, PacketFloat<4> b) { return {_mm_div_ps(a.v, b.v)}; }
+inline PacketFloat<4> packet_min(PacketFloat<4> a, PacketFloat<4> b) { return {_mm_min_ps(a.v, b.v)}; }
+inline PacketFloat<4> packet_max(PacketFloat<4> a, PacketFloat<4> b) { return {_mm_max_ps(a.v, b.v)}; }
+inline PacketFloat<4> packet_abs(PacketFloat<4> a) { return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)}; }
+inline uint32_t lanes_lt(PacketFloat<4> a, PacketFloat<4> b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+inline uint32_t lanes_le(PacketFloat<4> a, PacketFloat<4> b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+inline uint32_t lanes_gt(PacketFloat<4> a, PacketFloat<4> b) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, b.v)); }
+inline uint32_t lanes_ge(PacketFloat<4> a, PacketFloat<4> b) { return _mm_movemask_ps(_mm_cmpge_ps(a.v, b.v)); }
+#endif
+
+
+#if defined(__AVX__)
+template<>
+struct PacketFloat<8> {
+    __m256 v;
+
+    static inline PacketFloat load(const float *p) { return {_mm256_load_ps(p)}; }
+
+    static inline PacketFloat broadcast(float x) { return {_mm256_set1_ps(x)}; }
+
+    inline void store(float *p) const { _mm256_store_ps(p, v); }
+};
+
+inline PacketFloat<8> operator+(PacketFloat<8> a, PacketFloat<8> b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline PacketFloat<8> operator-(PacketFloat<8> a, PacketFloat<8> b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline PacketFloat<8> operator*(PacketFloat<8> a, PacketFloat<8> b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline PacketFloat<8> operator/(PacketFloat<8> a, PacketFloat<8> b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline PacketFloat<8> packet_min(PacketFloat<8> a, PacketFloat<8> b) { return {_mm256_min_ps(a.v, b.v)}; }
+inline PacketFloat<8> packet_max(PacketFloat<8> a, PacketFloat<8> b) { return {_mm256_max_ps(a.v, b.v)}; }
+inline PacketFloat<8> packet_abs(PacketFloat<8> a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v)}; }
+inline uint32_t lanes_lt(PacketFloat<8> a, PacketFloat<8> b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline uint32_t lanes_le(PacketFloat<8> a, PacketFloat<8> b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+inline uint32_t lanes_gt(PacketFloat<8> a, PacketFloat<8> b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+inline uint32_t lanes_ge(PacketFloat<8> a, PacketFloat<8> b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+#endif
+
+
+/* 光线包中的三维向量，按照 SoA 的方式存放 */
+template<int N_>
+struct PacketVec3 {
+    PacketFloat<N_> x, y, z;
+
+    static inline PacketVec3 broadcast(const Eigen::Vector3f &vec) {
+        return {PacketFloat<N_>::broadcast(vec.x()), PacketFloat<N_>::broadcast(vec.y()),
+                PacketFloat<N_>::broadcast(vec.z())};
+    }
+
+    inline PacketVec3 operator-(const PacketVec3 &rhs) const { return {x - rhs.x, y - rhs.y, z - rhs.z}; }
+
+    [[nodiscard]] inline PacketFloat<N_> dot(const PacketVec3 &rhs) const { return x * rhs.x + y * rhs.y + z * rhs.z; }
+
+    [[nodiscard]] inline PacketVec3 cross(const PacketVec3 &rhs) const {
+        return {y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z, x * rhs.y - y * rhs.x};
+    }
+};
+
+
+/**
+ * N 根光线组成的光线包，分量按照 SoA 的方式存放，便于 SIMD 指令读取
+ * mask 的第 i 位表示第 i 根光线是否有效，光线包不满时，无效的光线不参与求交
+ */
+template<int N_>
+struct RayPacket {
+    static constexpr int N = N_;
+
+    /* 将一根光线放入光线包的第 lane 个位置 */
+    inline void set(int lane, const Ray &ray) {
+        assert(lane >= 0 && lane < N_);
+        const Eigen::Vector3f orig = ray.origin();
+        const Eigen::Vector3f dir  = ray.direction().get();
+        ox[lane] = orig.x(), oy[lane] = orig.y(), oz[lane] = orig.z();
+        dx[lane] = dir.x(), dy[lane] = dir.y(), dz[lane] = dir.z();
+
+        /* 和包围盒某个面平行的方向，倒数设为无穷大，和 BoundingBox::isIntersect 中的平行判断对应 */
+        auto inv = [](float d) {
+            return std::abs(d) < std::numeric_limits<float>::epsilon()
+                           ? std::copysign(std::numeric_limits<float>::infinity(), d)
+                           : 1.f / d;
+        };
+        inv_dx[lane] = inv(dir.x()), inv_dy[lane] = inv(dir.y()), inv_dz[lane] = inv(dir.z());
+        mask |= 1u << lane;
+    }
+
+    /* 光线包中第 lane 根光线 */
+    [[nodiscard]] inline Ray ray(int lane) const {
+        return Ray({ox[lane], oy[lane], oz[lane]}, Eigen::Vector3f{dx[lane], dy[lane], dz[lane]});
+    }
+
+    [[nodiscard]] inline PacketVec3<N_> origin() const {
+        return {PacketFloat<N_>::load(ox), PacketFloat<N_>::load(oy), PacketFloat<N_>::load(oz)};
+    }
+
+    [[nodiscard]] inline PacketVec3<N_> direction() const {
+        return {PacketFloat<N_>::load(dx), PacketFloat<N_>::load(dy), PacketFloat<N_>::load(dz)};
+    }
+
+    alignas(32) float ox[N_]{}, oy[N_]{}, oz[N_]{};              /* 光线的原点 */
+    alignas(32) float dx[N_]{}, dy[N_]{}, dz[N_]{};              /* 光线的方向 */
+    alignas(32) float inv_dx[N_]{}, inv_dy[N_]{}, inv_dz[N_]{};  /* 方向的倒数，用于包围盒求交 */
+    uint32_t mask = 0;                                           /* 有效的光线 */
+};
+
+
+/* 光线包与场景求交的结果，t 是目前找到的最近交点的距离，没有交点时为无穷大 */
+template<int N_>
+struct PacketHit {
+    PacketHit() { std::fill(t, t + N_, std::numeric_limits<float>::infinity()); }
+
+    alignas(32) float t[N_];
+    std::array<Intersection, N_> inter{};
+};
+
+
+/**
+ * 光线包与包围盒求交：slab 方法，三个方向同时计算
+ * 包围盒的入点比 hit 中记录的交点还远时，包围盒内不会有更近的交点，这根光线也会被剔除
+ * @param mask 参与计算的光线
+ * @return 与包围盒相交的光线
+ */
+template<int N_>
+inline uint32_t packet_intersect_box(const BoundingBox &box, const RayPacket<N_> &packet, const PacketHit<N_> &hit,
+                                     uint32_t mask) {
+    using F = PacketFloat<N_>;
+
+    F t0_x = (F::broadcast(box.p_min.x()) - F::load(packet.ox)) * F::load(packet.inv_dx);
+    F t1_x = (F::broadcast(box.p_max.x()) - F::load(packet.ox)) * F::load(packet.inv_dx);
+    F t0_y = (F::broadcast(box.p_min.y()) - F::load(packet.oy)) * F::load(packet.inv_dy);
+    F t1_y = (F::broadcast(box.p_max.y()) - F::load(packet.oy)) * F::load(packet.inv_dy);
+    F t0_z = (F::broadcast(box.p_min.z()) - F::load(packet.oz)) * F::load(packet.inv_dz);
+    F t1_z = (F::broadcast(box.p_max.z()) - F::load(packet.oz)) * F::load(packet.inv_dz);
+
+    F t_enter = packet_max(packet_max(packet_min(t0_x, t1_x), packet_min(t0_y, t1_y)), packet_min(t0_z, t1_z));
+    F t_exit  = packet_min(packet_min(packet_max(t0_x, t1_x), packet_max(t0_y, t1_y)), packet_max(t0_z, t1_z));
+
+    return mask & lanes_le(t_enter, t_exit) & lanes_gt(t_exit, F::broadcast(0.f)) &
+           lanes_le(t_enter, F::load(hit.t));
+}
+
+
+#endif //RENDER_DEBUG_RAY_PACKET_H
@@ -1,6 +1,10 @@
 #ifndef RENDER_DEBUG_RAY_PATH_H
 #define RENDER_DEBUG_RAY_PATH_H
 
+#include <array>
+#include <vector>
+#include <cassert>
+
 #include <Eigen/Eigen>
 
 #include "ray.h"
@@ -46,6 +50,7 @@ struct PathNode {
         Eigen::Vector3f Li_light{0.f, 0.f, 0.f};
         Direction wi_light = Direction::zero();
         Intersection inter_light = Intersection::no_intersect();
+        float weight{0.f};      /* 光源的贡献是 Le * BRDF * weight：几何项除以 pdf，乘以 MIS 的权重；被遮挡时为 0 */
     } from_light;
 
     // 来自物体的入射光线
@@ -54,7 +59,86 @@ struct PathNode {
         Eigen::Vector3f Li_obj{0.f, 0.f, 0.f};
         Direction wi_obj = Direction::zero();
         Intersection inter_obj = Intersection::no_intersect();
+        float weight{0.f};      /* 下一段光路的贡献是 Li_obj * BRDF * weight：cos 除以方向的 pdf 和俄罗斯轮盘赌的概率 */
+        float mis{0.f};         /* 击中光源时，Li_obj 是光源的 Le 乘以这个 MIS 权重 */
     } from_obj;
 };
 
+
+/**
+ * 一个像素所有采样的亮度统计，用于找出离群的采样（萤火虫、NaN）
+ * 均值和标准差只统计 radiance 是有限值的采样
+ */
+struct PixelStat {
+    int spp = 0;                    /* 采样数量，为 0 表示没有统计 */
+    float lum_mean = 0.f;
+    float lum_std = 0.f;
+    int nonfinite_cnt = 0;          /* radiance 不是有限值的采样数量 */
+    std::vector<int> outliers;      /* 离群采样的序号，从小到大排列 */
+};
+
+
+// =========================================================
+// 路径记录的策略，作为积分器的模板参数，在编译期决定记录哪些信息
+// =========================================================
+
+/* 不记录任何信息，只计算 radiance */
+struct NoCapture {
+    static constexpr bool RECORD_RADIANCE = false;
+    static constexpr bool RECORD_PATH = false;
+};
+
+/* 只记录每个采样的 radiance，不记录路径的节点 */
+struct RadianceOnly {
+    static constexpr bool RECORD_RADIANCE = true;
+    static constexpr bool RECORD_PATH = false;
+};
+
+/* 记录完整的路径 */
+struct FullPath {
+    static constexpr bool RECORD_RADIANCE = true;
+    static constexpr bool RECORD_PATH = true;
+};
+
+
+/**
+ * 一条光路的节点缓存，容量固定，由每个渲染线程持有
+ * 迭代式的积分器将节点从摄像机开始依次写入，不会在采样过程中分配内存
+ * 每个节点还记录了一个 weight：下一段光路的 Radiance 乘以该值，就是它对当前节点 Lo 的贡献
+ */
+class PathBuffer {
+public:
+    static inline const int CAPACITY = 64;      /* 最多容纳的节点数量，达到上限后路径会被截断 */
+
+    /* 清空缓存，节点的内存会被复用 */
+    inline void clear() { _size = 0; }
+
+    /* 在末尾添加一个节点，并返回该节点 */
+    inline PathNode &push() {
+        assert(!full());
+        _nodes[_size]   = PathNode();
+        _weights[_size] = Eigen::Vector3f(0.f, 0.f, 0.f);
+        return _nodes[_size++];
+    }
+
+    [[nodiscard]] inline bool full() const { return _size >= CAPACITY; }
+
+    [[nodiscard]] inline int size() const { return _size; }
+
+    [[nodiscard]] inline PathNode &operator[](int idx) { return _nodes[idx]; }
+
+    [[nodiscard]] inline const PathNode &operator[](int idx) const { return _nodes[idx]; }
+
+    [[nodiscard]] inline Eigen::Vector3f &weight(int idx) { return _weights[idx]; }
+
+    [[nodiscard]] inline const PathNode *begin() const { return _nodes.data(); }
+
+    [[nodiscard]] inline const PathNode *end() const { return _nodes.data() + _size; }
+
+private:
+    std::array<PathNode, CAPACITY> _nodes{};
+    std::array<Eigen::Vector3f, CAPACITY> _weights{};
+    int _size = 0;
+};
+
 #endif //RENDER_DEBUG_RAY_PATH_H
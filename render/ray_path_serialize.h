@@ -1,6 +1,8 @@
 #ifndef RENDER_DEBUG_RAY_PATH_SERIALIZE_H
 #define RENDER_DEBUG_RAY_PATH_SERIALIZE_H
 
+#include <atomic>
+#include <string>
 #include <stdexcept>
 
 #include <sqlite3.h>
@@ -13,7 +15,7 @@
  * 将数据库常见的一些操作放在这个类里面
  *
  * 基本使用方法
- *  DB::init();
+ *  DB::init_db(path);
  *  ...
  *  DB::close_db();
  *
@@ -26,42 +28,71 @@ class DB {
 public:
     /* 初始化数据库连接 */
     static inline void init_db(const std::string &db_path) {
-        auto res = sqlite3_open(db_path.c_str(), &db);
-        if (SQLITE_OK != res)
-            throw std::runtime_error(fmt::format("fail to open sqlite3, path: {}", db_path));
+        db = open_db(db_path);
     }
 
     /* 断开数据库的连接 */
     static inline void close_db() {
-        sqlite3_close(db);
+        close_db(db);
         db = nullptr;
     }
 
     /* 开始事务 */
     static inline void transaction_begin() {
-        auto res = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, &err_msg);
-        if (SQLITE_OK != res)
-            throw std::runtime_error(fmt::format("fail to begin transaction, err msg: {}", err_msg));
+        transaction_begin(db);
     }
 
     /* 提交事务 */
     static inline void transaction_commit() {
-        auto res = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err_msg);
-        if (SQLITE_OK != res)
-            throw std::runtime_error(fmt::format("fail to begin transaction, err msg: {}", err_msg));
+        transaction_commit(db);
     }
 
     /**
-     * 构造一个在进程期间不会重复的 id
-     * @注 并不是线程安全的
+     * 打开一个独立的数据库连接，由调用者持有，用于多个渲染同时写入不同的数据库
+     * 下面几个带 sqlite3 * 参数的函数和上面的同名函数相同，只是操作指定的连接
      */
+    static inline sqlite3 *open_db(const std::string &db_path) {
+        sqlite3 *conn = nullptr;
+        auto res = sqlite3_open(db_path.c_str(), &conn);
+        if (SQLITE_OK != res) {
+            sqlite3_close(conn);
+            throw std::runtime_error(fmt::format("fail to open sqlite3, path: {}", db_path));
+        }
+        return conn;
+    }
+
+    static inline void close_db(sqlite3 *conn) {
+        sqlite3_close(conn);
+    }
+
+    static inline void transaction_begin(sqlite3 *conn) {
+        _exec(conn, "BEGIN;", "fail to begin transaction");
+    }
+
+    static inline void transaction_commit(sqlite3 *conn) {
+        _exec(conn, "COMMIT;", "fail to commit transaction");
+    }
+
+    /* 构造一个在进程期间不会重复的 id，线程安全 */
     static inline int64_t get_id() {
-        static int64_t static_id = 0;
-        return static_id++;
+        static std::atomic<int64_t> static_id{0};
+        return static_id.fetch_add(1, std::memory_order_relaxed);
     }
 
     static inline sqlite3 *db = nullptr;            /* 数据库的连接对象 */
-    static inline char *err_msg = nullptr;          /* 错误信息 */
+    static inline thread_local char *err_msg = nullptr;  /* 错误信息 */
+
+private:
+    /* 执行 sql 语句，失败时抛出异常；错误信息由每次调用自己持有，多个连接可以在不同的线程中使用 */
+    static inline void _exec(sqlite3 *conn, const char *sql, const char *what) {
+        char *msg = nullptr;
+        auto res = sqlite3_exec(conn, sql, nullptr, nullptr, &msg);
+        if (SQLITE_OK != res) {
+            std::string err = fmt::format("{}, err msg: {}", what, msg ? msg : "");
+            sqlite3_free(msg);
+            throw std::runtime_error(err);
+        }
+    }
 };
 
 
@@ -133,7 +164,7 @@ public:
     }
 
     /* 存放错误信息 */
-    static inline char *err_msg = nullptr;
+    static inline thread_local char *err_msg = nullptr;
 };
 
 
@@ -200,7 +231,7 @@ private:
             throw std::runtime_error(fmt::format("fail to insert into path, err msg: {}", err_msg));
     }
 
-    static inline char *err_msg = nullptr;          /* 存放错误信息 */
+    static inline thread_local char *err_msg = nullptr;  /* 存放错误信息 */
 
 private:
     int row{}, col{};                               /* 当前光路对应的屏幕像素坐标 */
@@ -208,4 +239,53 @@ private:
     std::vector<int64_t> path_node_ids{};           /* 光路各个节点的 id，从摄像机出发 */
 };
 
+
+/* 像素的采样统计，以及离群采样的序号 */
+class PixelStatSerialize {
+public:
+
+    static inline const char *TABLE = "pixel_stat";
+
+    /* 旧的数据库中可能没有这张表，表结构和 table-pixel_stat.sql 相同 */
+    static inline void createTable(sqlite3 *db) {
+        auto res = sqlite3_exec(db, fmt::format("CREATE TABLE IF NOT EXISTS {} (row integer, col integer, "
+                                                "spp integer, lum_mean real, lum_std real, nonfinite_cnt integer, "
+                                                "outlier_cnt integer, outlier_samples text)", TABLE).c_str(),
+                                nullptr, nullptr, &err_msg);
+        if (SQLITE_OK != res) {
+            throw std::runtime_error(fmt::format("fail to create table: {}", TABLE));
+        }
+    }
+
+    /* 删除数据库中的这张表 */
+    static inline void deleteTable(sqlite3 *db) {
+        auto res = sqlite3_exec(db, fmt::format("DELETE FROM {}", TABLE).c_str(),
+                                nullptr, nullptr, &err_msg);
+        if (SQLITE_OK != res) {
+            throw std::runtime_error(fmt::format("fail to delete table: {}", TABLE));
+        }
+    }
+
+    /**
+     * 写入一个像素的统计信息
+     * 离群采样的序号转换为字符串，如："3 17 "，和 path 表中这个像素的光路依次对应
+     */
+    static inline void insertStat(sqlite3 *db, int row, int col, const PixelStat &stat) {
+        std::string samples;
+        for (auto sample: stat.outliers) {
+            samples += fmt::format("{} ", sample);
+        }
+
+        auto res = sqlite3_exec(db, fmt::format("INSERT INTO {} VALUES ('{}', '{}', '{}', '{}', '{}', '{}', '{}', '{}')",
+                                                TABLE, row, col, stat.spp, stat.lum_mean, stat.lum_std,
+                                                stat.nonfinite_cnt, stat.outliers.size(), samples).c_str(),
+                                nullptr, nullptr, &err_msg);
+
+        if (SQLITE_OK != res)
+            throw std::runtime_error(fmt::format("fail to insert into pixel_stat, err msg: {}", err_msg));
+    }
+
+    static inline thread_local char *err_msg = nullptr;  /* 存放错误信息 */
+};
+
 #endif //RENDER_DEBUG_RAY_PATH_SERIALIZE_H
@@ -8,11 +8,19 @@
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <functional>
 
 #include <Eigen/Eigen>
 #include <fmt/format.h>
 
 #include "ray.h"
+#include "film.h"
+#include "gbuffer.h"
+#include "denoiser.h"
+#include "guiding.h"
+#include "radiance_cache.h"
+#include "vpl.h"
+#include "ray_packet.h"
 #include "scene.h"
 #include "object.h"
 #include "config.h"
@@ -22,11 +30,93 @@
 #include "ray_path_serialize.h"
 
 
+/* 直接光照的计算方式 */
+enum class LightSampling {
+    NEE,    /* 只对光源采样，BSDF 采样得到的光线击中光源时没有贡献 */
+    MIS,    /* 对光源采样和 BSDF 采样都计入贡献，使用 power heuristic 进行多重重要性采样 */
+};
+
+/**
+ * 积分器的类型
+ * 除了 PathTracing 之外都是预览用的积分器，只计算主光线的交点附近的信息，速度很快
+ */
+enum class IntegratorType {
+    PathTracing,        /* 完整的路径追踪 */
+    AmbientOcclusion,   /* 环境光遮蔽：在交点的半球内投射 ao_samples 根光线，统计没有被遮挡的比例 */
+    Normal,             /* 交点的法线，从 [-1, 1] 映射到 [0, 1] */
+    Albedo,             /* 交点处材质的反射率 */
+    Depth,              /* 交点的深度，越近越亮，以场景包围盒的对角线长度归一化 */
+    DirectLighting,     /* 只计算交点处来自光源的直接光照，不进行弹射 */
+    InstantRadiosity,   /* 交点的光照来自 RTRender::vpl_build 生成的虚拟点光源，没有噪声的全局光照近似 */
+};
+
+/**
+ * 路径长度的策略：每次弹射之后，决定光路是否继续
+ *  - 路径的节点数少于 min_depth 时，光路一定继续
+ *  - 之后进行俄罗斯轮盘赌：throughput_based 为 false 时，继续的概率固定为 survival；
+ *    否则和 throughput 的最大分量成正比，限制在 [min_survival, max_survival] 之间，暗的光路会更早地截断
+ *  - 节点数达到 max_depth 时一定截断，记录路径时还会受到 PathBuffer 容量的限制
+ * 默认的参数和原来的行为相同：从第一次弹射开始，以 0.8 的概率继续
+ */
+struct PathTermination {
+    int min_depth = 0;
+    int max_depth = PathBuffer::CAPACITY;
+    bool throughput_based = false;
+    float survival = 0.8f;
+    float min_survival = 0.05f;
+    float max_survival = 0.95f;
+
+    /**
+     * 光路继续的概率
+     * @param depth 路径目前的节点数
+     * @param throughput 从摄像机到当前节点的 throughput
+     */
+    [[nodiscard]] inline float survival_probability(int depth, const Eigen::Vector3f &throughput) const {
+        if (depth >= max_depth)
+            return 0.f;
+        if (depth < min_depth)
+            return 1.f;
+        if (!throughput_based)
+            return survival;
+        return std::clamp(throughput.maxCoeff(), min_survival, max_survival);
+    }
+};
+
+/* 积分器的选项，在渲染之前设置；wavefront 模式只支持路径追踪和默认的光源采样方式，也不使用路径引导 */
+struct IntegratorOptions {
+    IntegratorType type = IntegratorType::PathTracing;
+    int ao_samples = 16;        /* 环境光遮蔽的光线数量 */
+    float ao_radius = 0.f;      /* 环境光遮蔽的半径，超过这个距离的遮挡不计入；<= 0 表示不限制距离 */
+    LightSampling light_sampling = LightSampling::NEE;
+    PathTermination termination;
+    int primary_offsets = 1;    /* 每个像素的主光线数量（固定的子像素偏移），为 1 时只有穿过像素中心的光线 */
+    InstantRadiosity::Options vpl;  /* 虚拟点光源的参数，由 RTRender::vpl_build 设置 */
+    bool path_guiding = false;  /* 按照 RTRender::guiding 学习到的分布采样间接光照，需要先调用 train_guiding */
+    bool radiance_cache = false;  /* 漫反射表面的间接光照查询 RTRender::cache，需要先调用 cache_enable */
+};
+
+
+/**
+ * CaptureMode::Outliers 判断离群采样的标准
+ * 采样的亮度和同一像素其他采样的均值相差超过 k_sigma 倍标准差，并且超过 min_deviation；或者 radiance 不是有限值
+ */
+struct OutlierCriteria {
+    float k_sigma = 4.f;
+    float min_deviation = 0.5f;     /* 亮度偏差的下限，避免把暗像素中正常的波动当作离群 */
+    int min_spp = 4;                /* 有限采样少于这个数量时，只检查 radiance 是否是有限值 */
+};
+
+
 /**
  * 渲染场景，基本流程为：
- *  RTRender::init(...);
- *  RTRender::render();
- *  RTRender::write_to_file();
+ *  RTRender render(scene, spp);
+ *  render.render_atomic(...);
+ *  RTRender::write_to_file(render.framebuffer, ...);
+ * 每个实例持有自己的 framebuffer、积分器选项和数据库连接，场景（以及它的 BVH）是只读的，可以被多个实例共享；
+ * 多个实例可以在不同的线程中同时渲染，并行的部分都运行在共享的线程池 ThreadPool::shared() 上
+ * 同时渲染的实例需要写入不同的数据库，或者以 CaptureMode::None 渲染
+ * 每个采样的随机数种子只由 (像素, 采样序号, render_id) 决定，同一像素的采样按照序号的顺序累加，
+ * 因此相同的参数总是得到逐位相同的结果，和线程数量、调度顺序无关（使用 radiance 缓存时除外）
  */
 class RTRender {
 public:
@@ -40,42 +130,260 @@ public:
     struct RenderPixelResult {
         int col, row;
         std::vector<std::deque<PathNode>> path_list; /* 每个像素对应的光路 */
+        Eigen::Vector3f radiance{0.f, 0.f, 0.f};     /* 像素的 radiance：所有采样的均值 */
+        PixelStat stat;                              /* 采样的统计，只有 CaptureMode::Outliers 会计算 */
+    };
+
+    /**
+     * 渲染时记录光路信息的方式
+     *  None：不记录，也不会连接数据库，只得到图像
+     *  RadianceOnly：每个采样只记录一个节点，包含这个采样的 radiance
+     *  FullPath：记录完整的路径
+     *  Outliers：只记录离群采样（萤火虫、NaN）的完整路径，以及每个像素的统计信息，判断标准见 outlier_criteria
+     */
+    enum class CaptureMode {
+        None, RadianceOnly, FullPath, Outliers,
+    };
+
+    /* 画面切分成的一个矩形区块，包含区块内所有像素的渲染任务 */
+    struct RenderTile {
+        std::vector<RenderPixelTask> tasks;
+    };
+
+    /* 渲染一个区块得到的结果 */
+    using RenderTileResult = std::vector<std::shared_ptr<RenderPixelResult>>;
+
+    /* 画面中的一个矩形区域，(col, row) 是左上角的像素 */
+    struct PixelRect {
+        int col{}, row{};
+        int width{}, height{};
+    };
+
+    /* 区块的分发顺序：扫描线顺序，或者沿着空间填充曲线，让相邻的区块在时间上也相邻 */
+    enum class TileOrder {
+        Scanline, Morton, Hilbert,
+    };
+
+    /* wavefront 模式中，一条正在追踪的光路 */
+    struct WavefrontPath {
+        int pixel;                              /* 光路对应的像素索引 */
+        int slot;                               /* 光路在这一批中的序号，用于按采样的顺序累加 radiance */
+        Ray ray;                                /* 当前这一次弹射的延伸光线 */
+        Pcg32 rng;                              /* 光路自己的随机数发生器，和由哪个线程着色无关 */
+        Intersection inter;                     /* 延伸光线与场景的交点 */
+        Eigen::Vector3f throughput{1.f, 1.f, 1.f};
+        Eigen::Vector3f radiance{0.f, 0.f, 0.f};  /* 这条光路已经得到的 radiance */
+        int depth = 0;                          /* 已经弹射的次数 */
+        bool alive = true;                      /* 光路是否还需要继续追踪 */
+    };
+
+    /* wavefront 模式中，一根射向光源的 shadow ray */
+    struct WavefrontShadowRay {
+        bool valid = false;                     /* 光路在这次弹射中是否产生了 shadow ray */
+        int path_idx = -1;                      /* 产生该光线的光路 */
+        Eigen::Vector3f origin{0.f, 0.f, 0.f};
+        Direction direction;
+        float t_max = 0.f;                      /* 到光源采样点的距离，超过这个距离的交点不算遮挡 */
+        Eigen::Vector3f contribution{0.f, 0.f, 0.f};  /* 光源可见时，对光路 radiance 的贡献 */
+        bool visible = false;
     };
 
     using PixelType = std::array<unsigned char, 3>;
 
     /* 光线在物体上反射时，为了防止再与自身相交，让反射点沿法线偏离一定的距离 */
     static inline const float OFFSET = 0.01f;
-    static inline const float RussianRoulette = 0.8f;   /* 俄罗斯轮盘赌的概率 */
 
-    /* 渲染前的准备步骤：指定需要渲染的场景，以及 spp */
-    static void init(const std::shared_ptr<Scene> &scene, int spp) {
+    RTRender() = default;
+
+    /* 创建实例并调用 init */
+    RTRender(const std::shared_ptr<Scene> &scene, int spp, uint32_t render_id = 0) {
+        init(scene, spp, render_id);
+    }
+
+    /**
+     * 渲染前的准备步骤：指定需要渲染的场景，以及 spp
+     * @param render_id 渲染的 id，和像素、采样序号一起决定每个采样的随机数种子
+     */
+    void init(const std::shared_ptr<Scene> &scene, int spp, uint32_t render_id = 0) {
         /* 创建 framebuffer，设置背景色为黑色 */
-        framebuffer = std::vector<PixelType>(scene->screen_width() * scene->screen_width(),
+        framebuffer = std::vector<PixelType>(scene->screen_width() * scene->screen_height(),
                                              PixelType{0, 0, 0});
+        radiance_buffer = std::vector<Eigen::Vector3f>(scene->screen_width() * scene->screen_height(),
+                                                       Eigen::Vector3f::Zero());
         _scene = scene;
         _spp = spp;
+        _render_id = render_id;
+        gbuffer = GBuffer();
+        guiding = nullptr;
+        cache = nullptr;
+        vpls.clear();
     }
 
+    /**
+     * 重新追踪像素 (col, row) 的第 sample 个采样，得到和渲染时完全相同的光路
+     * 每个采样的随机数种子由 (像素, 采样序号, render_id) 决定，渲染时不记录光路也可以按需重建
+     * 场景和 render_id 需要和渲染时相同；wavefront 模式的采样不能重建
+     */
+    std::deque<PathNode> reconstruct_path(int col, int row, int sample);
+
     /**
      * 使用单线程来渲染场景
      * 会将详细的路径信息写入数据库，将像素信息写入 framebuffe 里面
      * @param db_path 存放光路信息的数据库
+     * @param capture 记录光路信息的方式，为 None 时不会连接数据库
      */
-    static void render_single_thread(const std::string &db_path);
+    void render_single_thread(const std::string &db_path, CaptureMode capture = CaptureMode::FullPath);
 
 
-    static void render_atomic(const std::string &db_path);
+    /**
+     * 使用多线程来渲染场景，线程之间没有锁：通过原子计数器领取区块
+     * @param tile_size 区块的边长（像素）
+     * @param tile_order 区块的分发顺序
+     * @param capture 记录光路信息的方式，为 None 时不会连接数据库
+     */
+    void render_atomic(const std::string &db_path, int tile_size = 16,
+                       TileOrder tile_order = TileOrder::Hilbert,
+                       CaptureMode capture = CaptureMode::FullPath);
 
 
     /**
      * 使用多线程来渲染场景
-     * @param worker_buffer_size worker 缓存的大小，缓存越小，加锁越频繁
+     * 任务的单位是区块，worker 每次从任务列表中取出若干个区块
+     * @param worker_buffer_size worker 缓存的大小（区块的数量），缓存越小，加锁越频繁
      * @param worker_sleep_ms 如果任务列表空了，worker 就会 sleep，该参数可以设置 sleep 的时间
      * @param master_process_interval 主线程处理结果的时间间隔，时间越小，加锁越频繁
+     * @param capture 记录光路信息的方式，为 None 时不会连接数据库
+     */
+    void render_multi_thread(const std::string &db_path, int worker_cnt, int worker_buffer_size,
+                             int worker_sleep_ms, int master_process_interval, int tile_size = 16,
+                             TileOrder tile_order = TileOrder::Hilbert,
+                             CaptureMode capture = CaptureMode::FullPath);
+
+    /**
+     * 只渲染并记录画面中的一个矩形区域，用于调试局部的问题
+     * 区域内的像素按照 capture 记录光路信息并写入数据库；超出画面的部分会被忽略
+     * @param render_others 是否以 CaptureMode::None 渲染区域外的像素，为 false 时区域外的 framebuffer 保持不变
+     */
+    void render_region(const std::string &db_path, const PixelRect &rect, bool render_others = false,
+                       CaptureMode capture = CaptureMode::FullPath);
+
+    /**
+     * 只渲染并记录若干个像素，和 render_region 相同
+     * @param pixels 像素的坐标 (col, row)，重复的像素只会渲染一次
+     */
+    void render_pixels(const std::string &db_path, const std::vector<std::pair<int, int>> &pixels,
+                       bool render_others = false, CaptureMode capture = CaptureMode::FullPath);
+
+    /**
+     * 渲染所有像素，以 FullPath 记录光路并保存在内存中，不会连接数据库，结果可以交给 reshade
+     * @return 每个像素的结果，按照先行后列的顺序排列
+     */
+    std::vector<std::shared_ptr<RenderPixelResult>> render_to_memory(unsigned thread_cnt);
+
+    /**
+     * 重新着色：修改材质的参数（漫反射颜色、发光值）之后，沿着记录的光路重新计算每个节点的 Lo，不需要重新追踪光线
+     * 采样方向、光源采样和 MIS 的 pdf 都和这些参数无关，记录的光路仍然是有效的采样
+     * 要求：光路来自路径追踪积分器，以 FullPath 记录；材质的类型不能改变（漫反射 <-> 发光体）
+     * 被 radiance 缓存截断的光路，末端的缓存值保持不变；数据库中的光路没有法线和材质，不能重新着色
+     * 结果写入 results 中每个像素的 radiance、framebuffer 和 radiance_buffer
+     */
+    void reshade(const std::vector<std::shared_ptr<RenderPixelResult>> &results, unsigned thread_cnt);
+
+    /**
+     * 以 wavefront 的方式渲染场景：将所有像素的采样分批，一批光路一起推进一次弹射
+     * 延伸光线和 shadow ray 分别排队，排序后按批次与场景求交；不会记录光路信息
+     * 每条光路有自己的随机数种子，按照采样的顺序累加，结果和 batch_size、线程数量无关
+     * @param batch_size 每一批同时追踪的光路数量
+     */
+    void render_wavefront(int batch_size = 1 << 16);
+
+    /**
+     * 渐进式渲染：一轮一轮地渲染，每一轮给所有像素增加 pass_spp 个采样，累积到 film 中
+     * 每一轮结束后都会更新 framebuffer；超过时间预算，或者所有像素的噪声都低于 target_noise 时停止
+     * 不使用 init 指定的 spp，也不会记录光路信息
+     * @param time_budget_ms 渲染的时间预算
+     * @param target_noise 像素噪声（亮度均值的标准误差）的目标，<= 0 表示只受时间预算的限制
+     * @param on_pass 每一轮结束后的回调，参数是目前的 spp，可以用来输出中间结果
+     * @return 最终每个像素的 spp
+     */
+    int render_progressive(int time_budget_ms, float target_noise, int pass_spp = 1,
+                           const std::function<void(int)> &on_pass = nullptr);
+
+    /**
+     * 自适应采样：先给所有像素 base_spp 个采样，之后每一轮只给相对误差大于 threshold 的像素增加 pass_spp 个采样
+     * 任务通过 Worker 分发给多个线程，结果累积到 film 中，每一轮结束后更新 framebuffer；不会记录光路信息
+     * @param max_spp 每个像素最多的采样数
+     * @param threshold 像素相对误差（亮度的标准误差和均值之比）的阈值
+     * @return 所有像素的采样总数
+     */
+    size_t render_adaptive(int base_spp, int max_spp, float threshold, int pass_spp, int worker_cnt);
+
+    /**
+     * 可以中断和继续的渲染：区块通过原子计数器分发，每个像素的采样累积到 film 中，直到所有像素都有 spp 个采样
+     * 每隔 checkpoint_interval_ms 把进度写入 checkpoint_path，渲染结束时也会写入一次；进程崩溃时最多损失一个间隔的进度
+     *  - checkpoint_path 已经存在时，先从中恢复（包括 spp），只追踪还没有完成的采样
+     *  - 采样序号就是像素已经累积的采样数，中断之后继续渲染，结果和一次完成的渲染完全相同
+     *  - checkpoint_path 为空时不读写文件，film 中已有的采样会保留
+     * 积分器的选项需要和保存进度时相同；不会记录光路信息
+     * @return 这一次新增的采样数
      */
-    static void render_multi_thread(const std::string &db_path, int worker_cnt, int worker_buffer_size,
-                                    int worker_sleep_ms, int master_process_interval);
+    size_t render_resumable(const std::string &checkpoint_path, int checkpoint_interval_ms = 60 * 1000,
+                            int tile_size = 16, TileOrder tile_order = TileOrder::Hilbert);
+
+    /**
+     * 给已经完成的渲染增加采样：从 checkpoint_path 恢复，每个像素再追踪 extra_spp 个采样，使用新的采样序号
+     * 结果和一开始就使用更多的 spp 渲染完全相同；之后的 spp 是增加之后的数量
+     */
+    size_t render_more(const std::string &checkpoint_path, int extra_spp, int checkpoint_interval_ms = 60 * 1000);
+
+    /**
+     * 将渲染的进度写入文件：画面大小、render_id、spp，以及 film 中每个像素的累积信息
+     * 先写入临时文件再重命名，写入的过程中崩溃不会破坏已有的进度
+     */
+    void checkpoint_save(const std::string &path) const;
+
+    /**
+     * 从文件中恢复渲染的进度，写入 film 和 spp
+     * 文件不存在时返回 false；文件损坏，或者画面大小、render_id 和当前的渲染不一致时抛出异常
+     */
+    bool checkpoint_load(const std::string &path);
+
+    /**
+     * 第一个交点的 AOV：反射率、法线、深度，是每个子像素偏移的交点的平均值
+     * 优先使用 gbuffer 中缓存的交点，没有缓存的像素会重新求交
+     */
+    AOVBuffer aov_get(unsigned thread_cnt);
+
+    /**
+     * 降噪：在渲染之后、write_to_file 之前调用
+     * 使用 AOV 引导的 À-Trous 滤波处理 radiance_buffer，将结果写入 framebuffer；radiance_buffer 保持不变
+     */
+    void denoise(const Denoiser::Options &options = {});
+
+    /**
+     * 训练路径引导：在 init 之后、渲染之前调用，训练完成后 integrator.path_guiding 为 true
+     * 每一轮给所有像素追踪 2^i 个采样（不写入 framebuffer），把路径上每个节点的入射 radiance 记录到 guiding 中，
+     * 一轮结束后细分 guiding 的结构；从第二轮开始，采样方向就已经由上一轮学习到的分布引导
+     * @param iterations 训练的轮数
+     */
+    void train_guiding(int iterations, const PathGuiding::Options &options = {});
+
+    /**
+     * 启用 radiance 缓存：在 init 之后、渲染之前调用，之后 integrator.radiance_cache 为 true
+     * 渲染时，路径从第 min_depth 个交点开始查询缓存，命中就用缓存的出射 radiance 结束路径；
+     * 没有命中的路径结束后，把这些交点的出射 radiance 插入缓存。缓存在多次渲染之间保留，直到下一次 init
+     * 缓存的内容和线程的执行顺序有关，渲染结果不再是确定的，reconstruct_path 也不能重建采样
+     */
+    void cache_enable(const RadianceCache::Options &options = {});
+
+    /**
+     * 生成虚拟点光源，并切换到 IntegratorType::InstantRadiosity：在 init 之后、渲染之前调用
+     * 每个交点需要向所有 VPL 投射一根 shadow ray，spp 为 1 就可以得到没有噪声的图像
+     */
+    void vpl_build(const InstantRadiosity::Options &options = {});
+
+    /* 采样数量图：每个像素的灰度和它的采样数成正比，采样最多的像素为白色 */
+    static std::vector<PixelType> sample_count_map(const Film &film);
 
     /* 将 framebuffer 写入 ppm 文件中 */
     static void write_to_file(const std::vector<PixelType> &buffer, const char *file_path,
@@ -83,32 +391,153 @@ public:
 
 private:
 
-    /* task：渲染一个像素 */
-    static std::shared_ptr<RenderPixelResult> jobRenderOnePixel(const RenderPixelTask &task);
+    /* 渲染一个像素的 task */
+    using PixelJob = std::shared_ptr<RenderPixelResult> (RTRender::*)(const RenderPixelTask &);
+
+    /* task：渲染一个像素，CaptureT_ 决定记录哪些光路信息 */
+    template<class CaptureT_>
+    std::shared_ptr<RenderPixelResult> jobRenderOnePixel(const RenderPixelTask &task);
+
+    /* 根据记录光路信息的方式，选择渲染一个像素的 task */
+    PixelJob pixel_job(CaptureMode capture);
+
+    /* task：渲染一个区块内的所有像素 */
+    RenderTileResult jobRenderOneTile(const RenderTile &tile, PixelJob pixel_job);
+
+    /* 使用当前的材质，从末端向摄像机重新计算一条光路每个节点的 Lo */
+    void reshade_path(std::deque<PathNode> &path);
 
     /* 使用渲染得到的结果来绘制 framebuffer */
-    static void drawFrameBuffer(const std::shared_ptr<RenderPixelResult> &res);
+    void drawFrameBuffer(const std::shared_ptr<RenderPixelResult> &res);
+
+    /* 使用累积缓冲来绘制整个 framebuffer */
+    void drawFrameBuffer(const Film &film);
 
-    /* 将一个像素对应的多个光线路径写入数据库 */
+    /**
+     * task：渲染一个像素，只记录离群的采样
+     * 先只计算 radiance，在线统计亮度的均值和方差；再把每个采样和其他采样比较，
+     * 离群的采样使用相同的随机数种子重新追踪，得到完整的光路
+     */
+    std::shared_ptr<RenderPixelResult> jobRenderOutliers(const RenderPixelTask &task);
+
+    /* 将一个像素对应的多个光线路径写入数据库，有统计信息时一起写入 */
     static inline void insert_pixel_ray(sqlite3 *db, const RenderPixelResult &res) {
         for (auto &path : res.path_list) {
             PathSerialize::insertPath(db, res.row, res.col, path);
         }
+        if (res.stat.spp > 0)
+            PixelStatSerialize::insertStat(db, res.row, res.col, res.stat);
+    }
+
+    /* 连接到数据库，并清空旧的光路和统计信息 */
+    void _db_open(const std::string &db_path);
+
+    /* 断开数据库的连接 */
+    inline void _db_close() {
+        DB::close_db(_db);
+        _db = nullptr;
+    }
+
+    /* 设置当前线程的随机数种子，之后追踪的光路就是像素 (col, row) 的第 sample 个采样 */
+    void _sample_seed_set(int col, int row, int sample) {
+        random_seed_set(sample_seed_get(row * _scene->screen_width() + col, sample, _render_id));
     }
 
     /* 根据场景和渲染参数生成的渲染任务 */
     static std::vector<RenderPixelTask> _prepare_render_task(const std::shared_ptr<Scene> &scene);
 
+    /**
+     * 一个像素的渲染任务：从摄像机穿过像素的光线
+     * @param offset 光线在像素内的位置，范围是 [0, 1)^2，默认是像素的中心
+     */
+    static RenderPixelTask _prepare_pixel_task(const std::shared_ptr<Scene> &scene, int col, int row,
+                                               const Eigen::Vector2f &offset = {0.5f, 0.5f});
+
+    /**
+     * 主光线的可见性计算：每个任务对应的像素，每个子像素偏移都只求交一次，结果写入 gbuffer
+     * 相邻像素的主光线组成光线包一起求交；所有基于 _prepare_render_task 的渲染入口都通过这里得到主光线的交点
+     * 子像素偏移的数量由 integrator.primary_offsets 决定
+     */
+    void _build_gbuffer(const std::vector<RenderPixelTask> &task_list, unsigned thread_cnt);
+
+    /* 像素 (col, row) 第 sample 个采样的主光线，以及它和场景的交点：优先使用 gbuffer，没有缓存时重新求交 */
+    std::tuple<Ray, Intersection> _primary_get(int col, int row, int sample);
+
+    /**
+     * 将渲染任务按照区块分组，区块按照 tile_order 排列
+     * 区块内的任务和 _prepare_render_task 相同，按照先行后列的顺序排列
+     */
+    static std::vector<RenderTile> _prepare_render_tiles(const std::shared_ptr<Scene> &scene, int tile_size,
+                                                         TileOrder tile_order);
+
+    /**
+     * wavefront 模式中，对一条光路和场景的交点进行着色
+     * 产生 shadow ray，并进行俄罗斯轮盘赌，生成下一次弹射的延伸光线
+     * @param [out]shadow 需要追踪的 shadow ray
+     */
+    void wavefront_shade(WavefrontPath &path, WavefrontShadowRay &shadow);
+
+    /**
+     * wavefront 模式中，计算第一次弹射（摄像机光线）与场景的交点
+     * 摄像机光线是连贯的，相邻的 RAY_PACKET_WIDTH 根光线组成一个光线包，一起遍历 BVH
+     */
+    void wavefront_intersect_primary(std::vector<WavefrontPath> &paths, unsigned thread_cnt);
+
     /* 向场景投射一根光线，得到路径信息 */
-    static std::deque<PathNode> cast_ray(const Ray &ray);
+    std::deque<PathNode> cast_ray(const Ray &ray);
 
     /**
-     * 向物体投射出一根光线，递归地得到路径信息
-     * @param inter 与该物体的交点
-     * @param [out]path 将结果写入该参数
-     * @note 需要保证该光线和物体相交，且物体不是发光的
+     * 迭代地追踪一根从摄像机出发的光线：沿路径向前累积 throughput
+     * @tparam CaptureT_ 记录路径的策略，只有 FullPath 会写入 buffer，其他策略没有额外的开销
+     * @param [out]buffer 将路径节点写入该缓存，缓存由调用的线程持有
+     * @return 这条光路的 radiance，和路径第一个节点的 Lo 相同
      */
-    static void cast_ray_recursive(const Ray &ray, const Intersection &inter, std::deque<PathNode> &path);
+    template<class CaptureT_ = FullPath>
+    Eigen::Vector3f trace_path(const Ray &ray, PathBuffer &buffer) {
+        return trace_path<CaptureT_>(ray, _scene->intersect(ray), buffer);
+    }
+
+    /* 和上面相同，摄像机光线和场景的交点 primary 已经求出来了，例如来自 gbuffer */
+    template<class CaptureT_ = FullPath>
+    Eigen::Vector3f trace_path(const Ray &ray, const Intersection &primary, PathBuffer &buffer);
+
+    /**
+     * 对光源采样，计算来自光源的直接光照
+     * @param inter 光线与物体的交点，物体不是发光的
+     * @param [out]node 将光源的相交信息写入该节点，只有 CaptureT_ 记录路径时才会使用
+     * @param mis 是否乘以 MIS 的权重，BSDF 采样击中光源的部分需要由调用者计算
+     */
+    template<class CaptureT_>
+    Eigen::Vector3f shade_light(const Ray &ray, const Intersection &inter, PathNode *node, bool mis);
+
+    /* 是否使用路径引导来采样间接光照的方向 */
+    bool _guiding_active() {
+        return integrator.path_guiding && guiding && guiding->trained();
+    }
+
+    /* 是否使用 radiance 缓存 */
+    bool _cache_active() {
+        return integrator.radiance_cache && cache;
+    }
+
+    /**
+     * 在交点处采样下一段光路的方向：不使用路径引导时就是 BSDF 采样
+     * 使用路径引导时是 one-sample MIS：以 bsdf_fraction 的概率按 BSDF 采样，否则按学习到的分布采样，pdf 是两者的混合
+     */
+    Material::BSDFSample _scatter_sample(const Ray &ray, const Intersection &inter);
+
+    /* _scatter_sample 采样得到方向 wi 的概率密度（立体角） */
+    float _scatter_pdf(const Ray &ray, const Intersection &inter, const Direction &wi);
+
+    /**
+     * 预览用的积分器，只使用摄像机光线的交点
+     * @param primary 摄像机光线和场景的交点
+     * @return 这个采样的颜色值
+     */
+    Eigen::Vector3f shade_preview(const Ray &ray, const Intersection &primary);
+
+    /* 交点处来自所有可见 VPL 的光照，交点不是发光体 */
+    Eigen::Vector3f shade_vpl(const Ray &ray, const Intersection &inter);
 
     /* 将 [0, 1] 范围的 Radiance 值进行 Gamma 矫正，并转换为 [0, 255] 的颜色值 */
     static inline PixelType gamma_correct(const Eigen::Vector3f &radiance) {
@@ -120,11 +549,22 @@ private:
 
 
 public:
-    static inline std::vector<PixelType> framebuffer; /* 渲染场景得到的帧缓冲 */
+    std::vector<PixelType> framebuffer;             /* 渲染场景得到的帧缓冲 */
+    std::vector<Eigen::Vector3f> radiance_buffer;   /* 和 framebuffer 对应的 radiance，没有经过 gamma 矫正 */
+    Film film;                                      /* 渐进式渲染的浮点累积缓冲 */
+    IntegratorOptions integrator;                   /* 积分器的选项 */
+    OutlierCriteria outlier_criteria;               /* CaptureMode::Outliers 判断离群采样的标准 */
+    GBuffer gbuffer;                                /* 主光线的交点，每次渲染开始时计算 */
+    std::shared_ptr<PathGuiding> guiding;           /* 路径引导学习到的 radiance 分布，由 train_guiding 创建 */
+    std::shared_ptr<RadianceCache> cache;           /* 漫反射表面的 radiance 缓存，由 cache_enable 创建 */
+    std::vector<VPL> vpls;                          /* 虚拟点光源，由 vpl_build 生成 */
 
 private:
-    static inline int _spp = 16;                      /* 每个像素投射多少根光线 */
-    static inline std::shared_ptr<Scene> _scene;      /* 需要渲染的场景 */
+    int _spp = 16;                                  /* 每个像素投射多少根光线 */
+    std::shared_ptr<Scene> _scene;                  /* 需要渲染的场景，可以被多个 RTRender 共享 */
+    uint32_t _render_id = 0;                        /* 渲染的 id，用于生成采样的随机数种子 */
+    bool _guiding_record = false;                   /* 是否正在训练路径引导：追踪光路时记录入射的 radiance */
+    sqlite3 *_db = nullptr;                         /* 记录光路信息的数据库连接，只在渲染期间打开 */
 };
 
 
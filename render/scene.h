@@ -45,9 +45,22 @@ public:
         return this->_camera.view_matrix_inverse * vec;
     }
 
-    /* 建立加速结构 */
-    void build() {
-        this->_bvh = BVH::build(this->_objs);
+    /**
+     * 同一个场景的另一个视角：物体和加速结构与当前场景共享，不需要重新加载模型，也不需要重新 build
+     * 参数和构造函数相同；得到的场景可以交给另一个 RTRender，和当前场景同时渲染
+     */
+    [[nodiscard]] std::shared_ptr<Scene> view(int screen_width, int screen_height, float fov,
+                                              const Eigen::Vector3f &camera_look_at,
+                                              const Eigen::Vector3f &camera_pos) const;
+
+    /* 建立加速结构；物体是模型时，模型内部的 BVH 在载入时已经建好，由 MeshTriangle::mesh_load 的参数决定 */
+    void build(BVHBuildMethod method = BVHBuildMethod::Median) {
+        this->_bvh = BVH::build(this->_objs, method);
+    }
+
+    /* 加速结构的 SAH 代价，包括模型内部的 BVH */
+    [[nodiscard]] inline float sah_cost() const {
+        return _bvh->sah_cost();
     }
 
     /* 向场景中添加一个物体 */
@@ -58,6 +71,20 @@ public:
         return _bvh->intersect(ray);
     }
 
+    /**
+     * 光线在 (0, t_max) 范围内是否被场景中的物体遮挡，用于 shadow ray
+     * 比 intersect 快：找到任意一个遮挡物就返回，不需要最近的交点
+     */
+    [[nodiscard]] inline bool occluded(const Ray &ray, float t_max) const {
+        return _bvh->occluded(ray, t_max);
+    }
+
+    /* 光线包和场景中物体的交点，只计算 packet.mask 中的光线 */
+    template<int N_>
+    inline void intersect(const RayPacket<N_> &packet, PacketHit<N_> &hit) const {
+        _bvh->intersect(packet, packet.mask, hit);
+    }
+
     /**
      * 基于面积，对场景中的所有光源进行随机采样
      * @return [pdf, 采样点的信息]
@@ -65,6 +92,13 @@ public:
      */
     [[nodiscard]] std::tuple<float, Intersection> sample_light() const;
 
+    /* sample_light 采样到光源上某一点的概率密度（面积测度），inter_light 不在光源上时为 0 */
+    [[nodiscard]] inline float pdf_light(const Intersection &inter_light) const {
+        if (!inter_light.happened() || !inter_light.mat()->is_emission() || _emit.total_area <= 0.f)
+            return 0.f;
+        return 1.f / _emit.total_area;
+    }
+
 private:
     /**
      * 生成一个变换矩阵：将摄像机坐标系中的坐标变换到世界坐标系
@@ -101,6 +135,9 @@ public:
     [[nodiscard]] inline Eigen::Vector3f camera_pos() const { return _camera.pos; };
 
     [[nodiscard]] inline const auto &emit() const { return _emit; }
+
+    /* 场景中所有物体的包围盒，需要先建立加速结构 */
+    [[nodiscard]] inline const BoundingBox &bounding_box() const { return _bvh->bounding_box(); }
 };
 
 
@@ -31,6 +31,10 @@ inline bool intersect_partial(float &t_min, float &t_max,
 }
 
 bool BoundingBox::isIntersect(const Ray &ray) const {
+    return isIntersect(ray, std::numeric_limits<float>::infinity());
+}
+
+bool BoundingBox::isIntersect(const Ray &ray, float t_max_seg) const {
     float t_min_x, t_max_x, t_min_y, t_max_y, t_min_z, t_max_z;
     if (!intersect_partial(t_min_x, t_max_x, ray.origin().x(), ray.direction().get().x(), p_min.x(), p_max.x()))
         return false;
@@ -41,7 +45,7 @@ bool BoundingBox::isIntersect(const Ray &ray) const {
 
     float t_min = std::max(t_min_x, std::max(t_min_y, t_min_z));
     float t_max = std::min(t_max_x, std::min(t_max_y, t_max_z));
-    return t_min <= t_max && t_max > 0;
+    return t_min <= t_max && t_max > 0 && t_min < t_max_seg;
 }
 
 
@@ -1,4 +1,9 @@
 #include "bvh.h"
+
+#include <array>
+#include <limits>
+#include <algorithm>
+
 #include "utils.h"
 
 
@@ -55,7 +60,7 @@ find_kth_obj(const std::vector<std::shared_ptr<Object>> &objs, unsigned int k, E
 }
 
 
-std::shared_ptr<BVH> BVH::build(const std::vector<std::shared_ptr<Object>> &objs) {
+std::shared_ptr<BVH> BVH::build(const std::vector<std::shared_ptr<Object>> &objs, BVHBuildMethod method) {
     auto obj_size = objs.size();
     assert(obj_size > 0);
 
@@ -70,15 +75,104 @@ std::shared_ptr<BVH> BVH::build(const std::vector<std::shared_ptr<Object>> &objs
         box.unionOp(obj->bounding_box());
     }
 
+    // 两侧的物体数量都 >= 1
+    auto[less, greater] = method == BVHBuildMethod::BinnedSAH ? _split_sah(objs, box) : _split_median(objs, box);
+    auto lchild = build(less, method);
+    auto rchild = build(greater, method);
+
+    return std::make_shared<BVH>(box, lchild->_area + rchild->_area,
+                                 lchild, rchild);
+}
+
+
+std::pair<std::vector<std::shared_ptr<Object>>, std::vector<std::shared_ptr<Object>>>
+BVH::_split_median(const std::vector<std::shared_ptr<Object>> &objs, const BoundingBox &box) {
     // 找到位于中间靠前的 object，可以确保 [less + k_th] 和 greater 的元素数量都 >= 1
     auto max_ext_dir = box.maxExtension();
-    auto[less, k_th, greater] = find_kth_obj(objs, (obj_size - 1) / 2, max_ext_dir);
+    auto[less, k_th, greater] = find_kth_obj(objs, (objs.size() - 1) / 2, max_ext_dir);
     less.push_back(k_th);
-    auto lchild = build(less);
-    auto rchild = build(greater);
+    return {std::move(less), std::move(greater)};
+}
 
-    return std::make_shared<BVH>(box, lchild->_area + rchild->_area,
-                                 lchild, rchild);
+
+std::pair<std::vector<std::shared_ptr<Object>>, std::vector<std::shared_ptr<Object>>>
+BVH::_split_sah(const std::vector<std::shared_ptr<Object>> &objs, const BoundingBox &box) {
+    // 重心的包围盒：桶在这个范围内等分
+    BoundingBox centroid_box;
+    for (const auto &obj : objs) {
+        centroid_box.unionOp(obj->bounding_box().center());
+    }
+    const Eigen::Vector3f c_min  = centroid_box.p_min;
+    const Eigen::Vector3f extent = centroid_box.diagonal();
+    auto bin_of = [&](const std::shared_ptr<Object> &obj, int axis) {
+        float t = (obj->bounding_box().center()[axis] - c_min[axis]) / extent[axis];
+        return std::clamp((int) (t * (float) SAH_BIN_CNT), 0, SAH_BIN_CNT - 1);
+    };
+
+    struct Bin {
+        BoundingBox box;
+        float cost = 0.f;
+        size_t cnt = 0;
+    };
+
+    float best_cost = std::numeric_limits<float>::infinity();
+    int best_axis = -1, best_split = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (!(extent[axis] > 0.f)) continue;
+
+        std::array<Bin, SAH_BIN_CNT> bins;
+        for (const auto &obj : objs) {
+            Bin &bin = bins[bin_of(obj, axis)];
+            bin.box.unionOp(obj->bounding_box());
+            bin.cost += obj->intersect_cost();
+            bin.cnt += 1;
+        }
+
+        // 从右向左累积：桶 [i, SAH_BIN_CNT) 的表面积和代价
+        std::array<float, SAH_BIN_CNT> right_area{}, right_cost{};
+        std::array<size_t, SAH_BIN_CNT> right_cnt{};
+        BoundingBox acc_box;
+        float acc_cost = 0.f;
+        size_t acc_cnt = 0;
+        for (int i = SAH_BIN_CNT - 1; i > 0; --i) {
+            acc_box.unionOp(bins[i].box);
+            acc_cost += bins[i].cost;
+            acc_cnt += bins[i].cnt;
+            right_area[i] = acc_box.surface_area();
+            right_cost[i] = acc_cost;
+            right_cnt[i]  = acc_cnt;
+        }
+
+        // 从左向右累积，在桶 i 之前划分
+        acc_box  = BoundingBox();
+        acc_cost = 0.f;
+        acc_cnt  = 0;
+        for (int i = 1; i < SAH_BIN_CNT; ++i) {
+            acc_box.unionOp(bins[i - 1].box);
+            acc_cost += bins[i - 1].cost;
+            acc_cnt += bins[i - 1].cnt;
+            if (acc_cnt == 0 || right_cnt[i] == 0) continue;
+
+            float cost = acc_box.surface_area() * acc_cost + right_area[i] * right_cost[i];
+            if (cost < best_cost) {
+                best_cost  = cost;
+                best_axis  = axis;
+                best_split = i;
+            }
+        }
+    }
+
+    // 所有物体的重心重合
+    if (best_axis < 0) {
+        return _split_median(objs, box);
+    }
+
+    std::vector<std::shared_ptr<Object>> less, greater;
+    for (const auto &obj : objs) {
+        if (bin_of(obj, best_axis) < best_split) less.push_back(obj);
+        else greater.push_back(obj);
+    }
+    return {std::move(less), std::move(greater)};
 }
 
 
@@ -121,6 +215,21 @@ Intersection BVH::intersect(const Ray &ray) const {
     }
 }
 
+bool BVH::occluded(const Ray &ray, float t_max) const {
+    if (!this->bounding_box().isIntersect(ray, t_max))
+        return false;
+
+    // 当前节点是叶子节点
+    if (this->_object) {
+        assert(!this->_lchild && !this->_rchild);
+        return _object->occluded(ray, t_max);
+    }
+
+    // 任意一个子树有遮挡就可以返回
+    assert(this->_lchild && this->_rchild);
+    return _lchild->occluded(ray, t_max) || _rchild->occluded(ray, t_max);
+}
+
 Intersection BVH::sample_obj(float area_threshold) {
     assert(this->_area - area_threshold > -epsilon_4);
 
@@ -137,3 +246,38 @@ Intersection BVH::sample_obj(float area_threshold) {
         return this->_rchild->sample_obj(area_threshold - this->_lchild->_area);
     }
 }
+
+
+template<int N_>
+void BVH::intersect(const RayPacket<N_> &packet, uint32_t mask, PacketHit<N_> &hit) const {
+
+    // 剔除与包围盒不相交的光线，以及包围盒比已有交点更远的光线
+    mask = packet_intersect_box(this->_box, packet, hit, mask);
+    if (!mask) return;
+
+    // 当前节点是叶子节点
+    if (this->_object) {
+        assert(!this->_lchild && !this->_rchild);
+        _object->intersect_packet(packet, mask, hit);
+        return;
+    }
+
+    /**
+     * 先访问离光线原点更近的子节点，
+     * 这样找到的交点会更早地更新 hit，另一个子节点有可能被整体剔除
+     */
+    assert(this->_lchild && this->_rchild);
+    int lane = 0;
+    while (!(mask >> lane & 1u)) ++lane;
+    Eigen::Vector3f orig(packet.ox[lane], packet.oy[lane], packet.oz[lane]);
+    float l_dis = (_lchild->_box.center() - orig).squaredNorm();
+    float r_dis = (_rchild->_box.center() - orig).squaredNorm();
+    const auto &near = l_dis <= r_dis ? _lchild : _rchild;
+    const auto &far  = l_dis <= r_dis ? _rchild : _lchild;
+    near->intersect(packet, mask, hit);
+    far->intersect(packet, mask, hit);
+}
+
+template void BVH::intersect<4>(const RayPacket<4> &packet, uint32_t mask, PacketHit<4> &hit) const;
+
+template void BVH::intersect<8>(const RayPacket<8> &packet, uint32_t mask, PacketHit<8> &hit) const;
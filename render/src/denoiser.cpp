@@ -0,0 +1,92 @@
+#include "denoiser.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "task.h"
+
+
+std::vector<Eigen::Vector3f> Denoiser::atrous(const std::vector<Eigen::Vector3f> &color, const AOVBuffer &aov,
+                                              const Options &options, unsigned thread_cnt)
+{
+    const int width  = aov.width;
+    const int height = aov.height;
+    assert(color.size() == (size_t) width * height);
+    assert(options.tile_size > 0);
+
+    /* B3 样条核 */
+    static const float kernel[5] = {1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+
+    const float inv_normal2 = 1.f / (options.sigma_normal * options.sigma_normal);
+    const float inv_albedo2 = 1.f / (options.sigma_albedo * options.sigma_albedo);
+
+    /* 两个缓冲交替作为输入和输出 */
+    std::vector<Eigen::Vector3f> src = color;
+    std::vector<Eigen::Vector3f> dst(color.size());
+
+    /* 按照区块划分任务 */
+    int tiles_x = (width + options.tile_size - 1) / options.tile_size;
+    int tiles_y = (height + options.tile_size - 1) / options.tile_size;
+
+    for (int iter = 0; iter < options.iterations; ++iter)
+    {
+        int step = 1 << iter;
+
+        /* 采样点的间隔越大，颜色的容忍度越小，避免把远处的光照变化混合进来 */
+        float sigma_color = options.sigma_color / (float) step;
+        float inv_color2  = 1.f / (sigma_color * sigma_color);
+        parallel_for((size_t) tiles_x * tiles_y, thread_cnt, 1, [&](size_t tile) {
+            int row_begin = (int) (tile / tiles_x) * options.tile_size;
+            int col_begin = (int) (tile % tiles_x) * options.tile_size;
+            int row_end   = std::min(row_begin + options.tile_size, height);
+            int col_end   = std::min(col_begin + options.tile_size, width);
+
+            for (int row = row_begin; row < row_end; ++row)
+            {
+                for (int col = col_begin; col < col_end; ++col)
+                {
+                    size_t p               = (size_t) row * width + col;
+                    Eigen::Vector3f c_p    = src[p].cwiseMax(0.f);
+                    Eigen::Vector3f tone_p = c_p.cwiseQuotient(c_p + Eigen::Vector3f::Ones());
+                    float depth_scale      = 1.f / (options.sigma_depth * std::max(aov.depth[p], 1e-4f));
+
+                    Eigen::Vector3f sum{0.f, 0.f, 0.f};
+                    float weight_sum = 0.f;
+                    for (int dy = -2; dy <= 2; ++dy)
+                    {
+                        int r = row + dy * step;
+                        if (r < 0 || r >= height)
+                            continue;
+                        for (int dx = -2; dx <= 2; ++dx)
+                        {
+                            int c = col + dx * step;
+                            if (c < 0 || c >= width)
+                                continue;
+
+                            size_t q               = (size_t) r * width + c;
+                            Eigen::Vector3f c_q    = src[q].cwiseMax(0.f);
+                            Eigen::Vector3f tone_q = c_q.cwiseQuotient(c_q + Eigen::Vector3f::Ones());
+
+                            /* 边缘保持的权重：差异越大，权重越小 */
+                            float e_color  = (tone_p - tone_q).squaredNorm() * inv_color2;
+                            float e_normal = (aov.normal[p] - aov.normal[q]).squaredNorm() * inv_normal2;
+                            float e_albedo = (aov.albedo[p] - aov.albedo[q]).squaredNorm() * inv_albedo2;
+                            float e_depth  = std::abs(aov.depth[p] - aov.depth[q]) * depth_scale;
+                            float w = kernel[dy + 2] * kernel[dx + 2] *
+                                      std::exp(-e_color - e_normal - e_albedo - e_depth);
+
+                            sum += w * c_q;
+                            weight_sum += w;
+                        }
+                    }
+
+                    /* 中心像素的权重不会是 0 */
+                    dst[p] = sum / weight_sum;
+                }
+            }
+        });
+        src.swap(dst);
+    }
+
+    return src;
+}
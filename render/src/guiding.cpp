@@ -0,0 +1,264 @@
+#include "guiding.h"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#include "utils.h"
+
+
+Eigen::Vector2f dir_to_canonical(const Direction &dir)
+{
+    const Eigen::Vector3f &d = dir.get();
+    float cos_theta = std::clamp(d.z(), -1.f, 1.f);
+    float phi       = std::atan2(d.y(), d.x());
+    if (phi < 0.f)
+        phi += 2.f * (float) M_PI;
+    float x = std::clamp((cos_theta + 1.f) * 0.5f, 0.f, 1.f);
+    float y = std::clamp(phi / (2.f * (float) M_PI), 0.f, 1.f);
+    return {std::min(x, 0.99999994f), std::min(y, 0.99999994f)};
+}
+
+
+Direction canonical_to_dir(const Eigen::Vector2f &p)
+{
+    float cos_theta = 2.f * p.x() - 1.f;
+    float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+    float phi       = 2.f * (float) M_PI * p.y();
+    return Direction(Eigen::Vector3f(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta));
+}
+
+
+// =============================================================================
+// DTree
+// =============================================================================
+
+DTree::DTree(const DTree &other)
+        : _nodes(other._nodes), _record_cnt(other.record_cnt()) {}
+
+
+DTree &DTree::operator=(const DTree &other)
+{
+    if (this != &other)
+    {
+        _nodes = std::vector<Node>(other._nodes);
+        _record_cnt.store(other.record_cnt(), std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+
+void DTree::record(const Eigen::Vector2f &p, float value)
+{
+    _record_cnt.fetch_add(1, std::memory_order_relaxed);
+    if (!(value > 0.f) || !std::isfinite(value))
+        return;
+
+    /* 从根节点向下，路径上每一层的象限都要累加能量 */
+    auto fixed = (uint64_t) std::llround(std::min(value, MAX_VALUE) * FIXED_SCALE);
+    if (fixed == 0)
+        return;
+    Eigen::Vector2f local = p;
+    uint32_t idx = 0;
+    for (;;)
+    {
+        int q = _quadrant(local);
+        _nodes[idx].sum[q].fetch_add(fixed, std::memory_order_relaxed);
+        if (_nodes[idx].child[q] == 0)
+            break;
+        idx = _nodes[idx].child[q];
+    }
+}
+
+
+Eigen::Vector2f DTree::sample() const
+{
+    Eigen::Vector2f origin{0.f, 0.f};
+    float size = 1.f;
+    uint32_t idx = 0;
+    for (;;)
+    {
+        const Node &node = _nodes[idx];
+        float total = _node_total(node);
+        if (total <= 0.f)
+            break;
+
+        /* 按照能量选择一个象限 */
+        float u = random_float_get() * total;
+        int q = 0;
+        for (; q < 3; ++q)
+        {
+            float s = _sum(node, q);
+            if (u < s)
+                break;
+            u -= s;
+        }
+        while (_sum(node, q) <= 0.f)
+            q = (q + 3) % 4;        /* 浮点误差导致落在能量为 0 的象限上 */
+
+        size *= 0.5f;
+        origin += Eigen::Vector2f((float) (q & 1), (float) (q >> 1)) * size;
+        if (node.child[q] == 0)
+            break;
+        idx = node.child[q];
+    }
+
+    /* 在选中的象限内均匀采样 */
+    float u1 = random_float_get();
+    float u2 = random_float_get();
+    return origin + Eigen::Vector2f(u1, u2) * size;
+}
+
+
+float DTree::pdf(const Eigen::Vector2f &p) const
+{
+    Eigen::Vector2f local = p;
+    float density = 1.f;
+    uint32_t idx = 0;
+    for (;;)
+    {
+        const Node &node = _nodes[idx];
+        float total = _node_total(node);
+        if (total <= 0.f)
+            return density;
+        int q = _quadrant(local);
+        density *= 4.f * _sum(node, q) / total;
+        if (node.child[q] == 0 || density <= 0.f)
+            return density;
+        idx = node.child[q];
+    }
+}
+
+
+DTree DTree::refined(float energy_threshold, int max_depth) const
+{
+    DTree dst;
+    float total = this->total();
+    if (total <= 0.f)
+        return dst;
+
+    std::array<float, 4> energy{};
+    for (int q = 0; q < 4; ++q)
+        energy[q] = _sum(_nodes[0], q) / total;
+    _build(dst, 0, 0, energy, 1, energy_threshold, max_depth);
+    return dst;
+}
+
+
+void DTree::_build(DTree &dst, uint32_t dst_idx, int src, const std::array<float, 4> &energy, int depth,
+                   float energy_threshold, int max_depth) const
+{
+    if (depth >= max_depth)
+        return;
+    for (int q = 0; q < 4; ++q)
+    {
+        if (energy[q] <= energy_threshold)
+            continue;
+
+        /* 原来的树在这个象限有细分，就使用细分的能量；否则认为能量在四个子象限中均匀分布 */
+        std::array<float, 4> child_energy{};
+        int src_child = src >= 0 && _nodes[src].child[q] != 0 ? (int) _nodes[src].child[q] : -1;
+        if (src_child >= 0)
+        {
+            float scale = energy[q] / std::max(_node_total(_nodes[src_child]), 1e-30f);
+            for (int i = 0; i < 4; ++i)
+                child_energy[i] = _sum(_nodes[src_child], i) * scale;
+        }
+        else
+        {
+            child_energy.fill(energy[q] / 4.f);
+        }
+
+        auto child_idx = (uint32_t) dst._nodes.size();
+        dst._nodes.emplace_back();
+        dst._nodes[dst_idx].child[q] = child_idx;
+        _build(dst, child_idx, src_child, child_energy, depth + 1, energy_threshold, max_depth);
+    }
+}
+
+
+// =============================================================================
+// PathGuiding
+// =============================================================================
+
+PathGuiding::PathGuiding(const BoundingBox &bounds, const Options &options)
+        : _options(options), _bounds(bounds), _nodes(1), _leaves(1)
+{
+    assert(options.bsdf_fraction >= 0.f && options.bsdf_fraction <= 1.f);
+}
+
+
+uint32_t PathGuiding::_leaf_of(const Eigen::Vector3f &pos) const
+{
+    Eigen::Vector3f p_min = _bounds.p_min;
+    Eigen::Vector3f p_max = _bounds.p_max;
+    uint32_t idx = 0;
+    while (_nodes[idx].child[0] != 0)
+    {
+        int axis  = _nodes[idx].axis;
+        float mid = 0.5f * (p_min[axis] + p_max[axis]);
+        if (pos[axis] < mid)
+        {
+            p_max[axis] = mid;
+            idx = _nodes[idx].child[0];
+        }
+        else
+        {
+            p_min[axis] = mid;
+            idx = _nodes[idx].child[1];
+        }
+    }
+    return _nodes[idx].leaf;
+}
+
+
+void PathGuiding::record(const Eigen::Vector3f &pos, const Direction &wi, float value)
+{
+    _leaves[_leaf_of(pos)].building.record(dir_to_canonical(wi), value);
+}
+
+
+std::tuple<Direction, float> PathGuiding::sample(const Eigen::Vector3f &pos) const
+{
+    const DTree &tree = _leaves[_leaf_of(pos)].sampling;
+    Eigen::Vector2f p = tree.sample();
+    return {canonical_to_dir(p), tree.pdf(p) / (4.f * (float) M_PI)};
+}
+
+
+float PathGuiding::pdf(const Eigen::Vector3f &pos, const Direction &wi) const
+{
+    return _leaves[_leaf_of(pos)].sampling.pdf(dir_to_canonical(wi)) / (4.f * (float) M_PI);
+}
+
+
+void PathGuiding::refine()
+{
+    /* 1. 空间细分：这一轮记录过多的叶子一分为二，两个子节点继承原来的方向分布 */
+    const size_t node_cnt = _nodes.size();
+    for (size_t i = 0; i < node_cnt; ++i)
+    {
+        if (_nodes[i].child[0] != 0 || _leaves[_nodes[i].leaf].building.record_cnt() <= _options.spatial_threshold)
+            continue;
+
+        SNode parent = _nodes[i];
+        for (int k = 0; k < 2; ++k)
+        {
+            SNode child;
+            child.axis = (parent.axis + 1) % 3;
+            child.leaf = k == 0 ? parent.leaf : (uint32_t) _leaves.size();
+            if (k == 1)
+                _leaves.push_back(_leaves[parent.leaf]);
+            _nodes[i].child[k] = (uint32_t) _nodes.size();
+            _nodes.push_back(child);
+        }
+    }
+
+    /* 2. 这一轮记录的分布用于之后的采样，并根据它生成下一轮记录用的树结构 */
+    for (auto &leaf : _leaves)
+    {
+        leaf.sampling = leaf.building;
+        leaf.building = leaf.sampling.refined(_options.energy_threshold, _options.max_depth);
+    }
+    ++_iteration;
+}
@@ -19,6 +19,49 @@ std::tuple<float, Direction> Material::sample_himsphere_random(const Direction &
 }
 
 
+/**
+ * 按照余弦加权，在半球内采样：pdf = cos(theta) / pi
+ *  - 在单位圆盘内均匀采样，再投影到半球上（Malley 方法）
+ */
+std::tuple<float, Direction> Material::sample_himsphere_cosine(const Direction &N) {
+
+    // random_float_get 的范围是 [0, 1)，所以 z 总是大于 0
+    float u = random_float_get();
+    float phi = random_float_get() * (float) M_PI * 2.f;
+
+    float r = std::sqrt(u);
+    float z = std::sqrt(1.f - u);
+    Direction local({r * std::cos(phi), r * std::sin(phi), z});
+    return {z / (float) M_PI, local_to_world(N, local)};
+}
+
+
+Material::BSDFSample Material::sample(const Direction &wo, const Direction &N) const {
+    switch (_mat_type) {
+        case MaterialType::Diffuse: {
+            auto [pdf, wi] = sample_himsphere_cosine(N);
+            return {wi, pdf, brdf_phong(wi, wo, N)};
+        }
+        case MaterialType::Emission:
+            return {};
+        default:
+            throw std::runtime_error("never");
+    }
+}
+
+
+float Material::pdf(const Direction &wi, const Direction &wo, const Direction &N) const {
+    switch (_mat_type) {
+        case MaterialType::Diffuse:
+            return std::max(0.f, N.get().dot(wi.get())) / (float) M_PI;
+        case MaterialType::Emission:
+            return 0.f;
+        default:
+            throw std::runtime_error("never");
+    }
+}
+
+
 /**
  * 将局部坐标系中的向量转换为全局坐标系的向量
  * - 以固定的方式，通过物体表面法线来建立局部坐标系
@@ -0,0 +1,124 @@
+#include "radiance_cache.h"
+
+#include <cmath>
+#include <cassert>
+
+#include "utils.h"
+
+
+RadianceCache::RadianceCache(const BoundingBox &bounds, const Options &options)
+        : _options(options)
+{
+    assert(options.normal_resolution > 0 && options.min_count > 0 && options.capacity > 0);
+    float cell_size = options.cell_size > 0.f ? options.cell_size : bounds.diagonal().norm() / 64.f;
+    _inv_cell_size  = 1.f / cell_size;
+
+    size_t capacity = 1;
+    while (capacity < options.capacity)
+        capacity <<= 1;
+    _mask    = capacity - 1;
+    _entries = std::make_unique<Entry[]>(capacity);
+}
+
+
+uint64_t RadianceCache::_key_of(const Eigen::Vector3f &pos, const Direction &N) const
+{
+    /* 位置所在的网格 */
+    uint64_t key = 0;
+    for (int i = 0; i < 3; ++i)
+        key = hash_mix_64(key ^ (uint64_t) (int64_t) std::floor(pos[i] * _inv_cell_size));
+
+    /* 法线的每个分量量化为 [0, 2 * res] 的整数 */
+    const int res  = _options.normal_resolution;
+    uint64_t normal = 0;
+    for (int i = 0; i < 3; ++i)
+        normal = normal * (2 * res + 1) + (uint64_t) (std::lround(N.get()[i] * (float) res) + res);
+
+    key = hash_mix_64(key ^ normal);
+    return key == 0 ? 1 : key;
+}
+
+
+RadianceCache::Entry *RadianceCache::_find(uint64_t key, bool insert) const
+{
+    for (int i = 0; i < MAX_PROBE; ++i)
+    {
+        Entry &entry = _entries[(key + i) & _mask];
+        uint64_t cur = entry.key.load(std::memory_order_acquire);
+        if (cur == key)
+            return &entry;
+        if (cur != 0)
+            continue;
+        if (!insert)
+            return nullptr;
+
+        /* 尝试占用空的条目；失败时 cur 是其他线程写入的键，可能和 key 相同 */
+        if (entry.key.compare_exchange_strong(cur, key, std::memory_order_acq_rel) || cur == key)
+            return &entry;
+    }
+    return nullptr;
+}
+
+
+void RadianceCache::insert(const Eigen::Vector3f &pos, const Direction &N, const Eigen::Vector3f &Lo)
+{
+    if (!Lo.allFinite())
+        return;
+    Entry *entry = _find(_key_of(pos, N), true);
+    if (!entry)
+        return;
+
+    for (int i = 0; i < 3; ++i)
+        atomic_float_add(entry->sum[i], Lo[i]);
+    float lum = luminance(Lo);
+    atomic_float_add(entry->sum_lum2, lum * lum);
+    entry->count.fetch_add(1, std::memory_order_release);
+}
+
+
+bool RadianceCache::_valid(const Entry &entry, Eigen::Vector3f *mean) const
+{
+    uint32_t n = entry.count.load(std::memory_order_acquire);
+    if (n < _options.min_count)
+        return false;
+
+    Eigen::Vector3f m{entry.sum[0].load(std::memory_order_relaxed),
+                      entry.sum[1].load(std::memory_order_relaxed),
+                      entry.sum[2].load(std::memory_order_relaxed)};
+    m /= (float) n;
+
+    /* 均值的标准误差：sqrt(Var / n) */
+    float lum_mean = luminance(m);
+    float variance = std::max(0.f, entry.sum_lum2.load(std::memory_order_relaxed) / (float) n - lum_mean * lum_mean);
+    if (std::sqrt(variance / (float) n) > _options.max_error * std::max(lum_mean, 1e-4f))
+        return false;
+
+    if (mean)
+        *mean = m;
+    return true;
+}
+
+
+bool RadianceCache::query(const Eigen::Vector3f &pos, const Direction &N, Eigen::Vector3f &Lo) const
+{
+    const Entry *entry = _find(_key_of(pos, N), false);
+    return entry && _valid(*entry, &Lo);
+}
+
+
+size_t RadianceCache::entry_cnt() const
+{
+    size_t cnt = 0;
+    for (size_t i = 0; i <= _mask; ++i)
+        cnt += _entries[i].key.load(std::memory_order_relaxed) != 0;
+    return cnt;
+}
+
+
+size_t RadianceCache::valid_cnt() const
+{
+    size_t cnt = 0;
+    for (size_t i = 0; i <= _mask; ++i)
+        cnt += _entries[i].key.load(std::memory_order_relaxed) != 0 && _valid(_entries[i], nullptr);
+    return cnt;
+}
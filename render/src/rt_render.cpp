@@ -1,7 +1,23 @@
 #include "rt_render.h"
 
 #include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <algorithm>
+
+/* 对光源采样时，反射方程中除了 Le 和 BRDF 之外的部分：几何项除以 pdf */
+inline float light_geometry_weight(const Intersection &inter, const Intersection &inter_light, const Direction &wi,
+                                   float pdf_light)
+{
+    float dis_to_light  = (inter_light.pos() - inter.pos()).norm();
+    float dis_to_light2 = dis_to_light * dis_to_light;
+    float cos_theta     = std::max(0.f, inter.normal().get().dot(wi.get()));
+    float cos_theta_1   = std::max(0.f, inter_light.normal().get().dot(-wi.get()));
+    return cos_theta * cos_theta_1 / dis_to_light2 / pdf_light;
+}
+
 
 /**
  * 计算反射方程，对光源采样
@@ -15,166 +31,474 @@
 inline Eigen::Vector3f reflect_equation_light(const Intersection &inter, const Intersection &inter_light,
                                               const Direction &wi, const Direction &wo, float pdf_light)
 {
+    auto Li   = inter_light.mat()->emission();
+    auto BRDF = inter.mat()->brdf_phong(wi, wo, inter.normal());
+    return Li.array() * BRDF.array() * light_geometry_weight(inter, inter_light, wi, pdf_light);
+}
 
-    float dis_to_light  = (inter_light.pos() - inter.pos()).norm();
-    float dis_to_light2 = dis_to_light * dis_to_light;
-    float cos_theta     = std::max(0.f, inter.normal().get().dot(wi.get()));
-    float cos_theta_1   = std::max(0.f, inter_light.normal().get().dot(-wi.get()));
-    auto Li             = inter_light.mat()->emission();
-    auto BRDF           = inter.mat()->brdf_phong(wi, wo, inter.normal());
-    return Li.array() * BRDF.array() * cos_theta * cos_theta_1 / dis_to_light2 / pdf_light;
+
+/**
+ * 多重重要性采样的 power heuristic（beta = 2）
+ * @return 使用 pdf_a 对应的采样策略时，这个采样的权重
+ */
+inline float power_heuristic(float pdf_a, float pdf_b)
+{
+    float a2 = pdf_a * pdf_a;
+    float b2 = pdf_b * pdf_b;
+    return a2 + b2 > 0.f ? a2 / (a2 + b2) : 0.f;
+}
+
+
+/**
+ * 将光源上采样点的 pdf 从面积测度转换为以 pos 为中心的立体角测度
+ * @param pdf_area 面积测度的 pdf
+ * @param wi 从 pos 射向光源的方向
+ */
+inline float pdf_area_to_solid_angle(float pdf_area, const Eigen::Vector3f &pos, const Intersection &inter_light,
+                                     const Direction &wi)
+{
+    float dis2      = (inter_light.pos() - pos).squaredNorm();
+    float cos_light = std::abs(inter_light.normal().get().dot(wi.get()));
+    return cos_light > epsilon_7 ? pdf_area * dis2 / cos_light : 0.f;
+}
+
+
+/**
+ * 构造从交点射向光源采样点的 shadow ray，只需要判断线段上有没有遮挡，交给 Scene::occluded
+ * 原点沿法线偏移 OFFSET，防止与自身相交；光线直接指向采样点，终点同样留出 OFFSET，采样点所在的表面不算遮挡
+ * @param [out]t_max 线段的长度
+ */
+inline Ray shadow_ray_get(const Intersection &inter, const Intersection &inter_light, float &t_max)
+{
+    Eigen::Vector3f origin   = inter.pos() + inter.normal().get() * RTRender::OFFSET;
+    Eigen::Vector3f to_light = inter_light.pos() - origin;
+    t_max                    = to_light.norm() - RTRender::OFFSET;
+    return Ray{origin, to_light};
+}
+
+
+/**
+ * 延伸光线的排序键：先按照方向所在的卦限，再按照原点在场景包围盒中的 Morton 码
+ * 排序后相邻的光线会访问相近的 BVH 节点
+ */
+inline uint64_t ray_coherence_key(const Ray &ray, const BoundingBox &bounds)
+{
+    Eigen::Vector3f dir = ray.direction().get();
+    uint64_t octant = (dir.x() < 0.f ? 1u : 0u) | (dir.y() < 0.f ? 2u : 0u) | (dir.z() < 0.f ? 4u : 0u);
+
+    Eigen::Vector3f extent = bounds.diagonal().cwiseMax(epsilon_4);
+    Eigen::Vector3f local  = (ray.origin() - bounds.p_min).cwiseQuotient(extent).cwiseMax(0.f).cwiseMin(1.f);
+    uint32_t morton        = morton_encode_3d((uint32_t) (local.x() * 1023.f), (uint32_t) (local.y() * 1023.f),
+                                              (uint32_t) (local.z() * 1023.f));
+    return (octant << 30) | morton;
+}
+
+
+/**
+ * 将光线队列按照连贯性排序
+ * @param ray_of 从队列的元素中得到光线
+ */
+template<class T_, class RayFuncT_>
+void sort_coherent(std::vector<T_> &queue, const BoundingBox &bounds, const RayFuncT_ &ray_of)
+{
+    std::vector<std::pair<uint64_t, size_t>> keys(queue.size());
+    for (size_t i = 0; i < queue.size(); ++i)
+        keys[i] = {ray_coherence_key(ray_of(queue[i]), bounds), i};
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<T_> sorted;
+    sorted.reserve(queue.size());
+    for (auto &key : keys)
+        sorted.push_back(std::move(queue[key.second]));
+    queue.swap(sorted);
+}
+
+
+template<class CaptureT_>
+Eigen::Vector3f RTRender::shade_light(const Ray &ray, const Intersection &inter, PathNode *node, bool mis)
+{
+    // 在场景中的光源进行随机采样
+    auto [pdf_light, inter_light] = _scene->sample_light();
+
+    // 如果场景中并没有光源：
+    if (!inter_light.happened())
+    {
+        if constexpr (CaptureT_::RECORD_PATH)
+            node->set_light_inter(Eigen::Vector3f(0.f, 0.f, 0.f), Direction::zero(), Intersection::no_intersect());
+        return {0.f, 0.f, 0.f};
+    }
+    assert(inter_light.mat()->is_emission());
+
+    // 判断到光源采样点的路上是否有被遮挡；反射方程中的方向以交点本身为起点
+    float t_max;
+    Ray ray_to_light = shadow_ray_get(inter, inter_light, t_max);
+    Direction wi(inter_light.pos() - inter.pos());
+    if (_scene->occluded(ray_to_light, t_max))
+    {
+        // 只有记录路径时才需要知道遮挡物是什么
+        if constexpr (CaptureT_::RECORD_PATH)
+            node->set_light_inter(Eigen::Vector3f(0.f, 0.f, 0.f), wi, _scene->intersect(ray_to_light));
+        return {0.f, 0.f, 0.f};
+    }
+
+    // 计算反射方程，添加路径信息
+    if constexpr (CaptureT_::RECORD_PATH)
+        node->set_light_inter(inter_light.mat()->emission(), wi, inter_light);
+    Eigen::Vector3f L_light = reflect_equation_light(inter, inter_light, wi, -ray.direction(), pdf_light);
+
+    // MIS：这个方向也可能由 BSDF 采样得到
+    float mis_weight = 1.f;
+    if (mis)
+    {
+        float pdf_light_sa = pdf_area_to_solid_angle(pdf_light, inter.pos(), inter_light, wi);
+        float pdf_bsdf     = _scatter_pdf(ray, inter, wi);
+        mis_weight         = power_heuristic(pdf_light_sa, pdf_bsdf);
+        L_light *= mis_weight;
+    }
+    if constexpr (CaptureT_::RECORD_PATH)
+        node->from_light.weight = light_geometry_weight(inter, inter_light, wi, pdf_light) * mis_weight;
+    return L_light;
+}
+
+
+Material::BSDFSample RTRender::_scatter_sample(const Ray &ray, const Intersection &inter)
+{
+    const Direction wo = -ray.direction();
+    if (!_guiding_active())
+        return inter.mat()->sample(wo, inter.normal());
+
+    Direction wi = random_float_get() < guiding->options().bsdf_fraction
+                   ? inter.mat()->sample(wo, inter.normal()).wi
+                   : std::get<0>(guiding->sample(inter.pos()));
+    return {wi, _scatter_pdf(ray, inter, wi), inter.mat()->brdf_phong(wi, wo, inter.normal())};
+}
+
+
+float RTRender::_scatter_pdf(const Ray &ray, const Intersection &inter, const Direction &wi)
+{
+    float pdf_bsdf = inter.mat()->pdf(wi, -ray.direction(), inter.normal());
+    if (!_guiding_active())
+        return pdf_bsdf;
+    float alpha = guiding->options().bsdf_fraction;
+    return alpha * pdf_bsdf + (1.f - alpha) * guiding->pdf(inter.pos(), wi);
 }
 
 
-void RTRender::cast_ray_recursive(const Ray &ray, const Intersection &inter, std::deque<PathNode> &path)
+template<class CaptureT_>
+Eigen::Vector3f RTRender::trace_path(const Ray &camera_ray, const Intersection &primary, PathBuffer &buffer)
 {
-    assert(inter.happened());
-    assert(!inter.mat()->is_emission());
+    if constexpr (CaptureT_::RECORD_PATH)
+        buffer.clear();
+    Intersection inter = primary;
+
+    /* 预览用的积分器：只有一个节点 */
+    if (integrator.type != IntegratorType::PathTracing)
+    {
+        Eigen::Vector3f Lo = shade_preview(camera_ray, inter);
+        if constexpr (CaptureT_::RECORD_PATH)
+        {
+            PathNode &node = buffer.push();
+            node.Lo        = Lo;
+            node.wo        = -camera_ray.direction();
+            node.pos_out   = camera_ray.origin();
+            node.inter     = inter;
+        }
+        return Lo;
+    }
+
+    /**
+     * 从摄像机射出一根光线，有三种情况
+     *  1. 不和任何物体相交
+     *  2. 和发光体相交，返回相交的信息
+     *      （因为这里使用了单独的对光源采样，所以需要单独处理这种情况）
+     *  3. 和不发光的物体相交，迭代地计算光路
+     */
+    if (!inter.happened() || inter.mat()->is_emission())
+    {
+        Eigen::Vector3f Lo = inter.happened() ? inter.mat()->emission() : Eigen::Vector3f(0.f, 0.f, 0.f);
+        if constexpr (CaptureT_::RECORD_PATH)
+        {
+            PathNode &node = buffer.push();
+            node.Lo        = Lo;
+            node.wo        = -camera_ray.direction();
+            node.pos_out   = camera_ray.origin();
+            node.inter     = inter; /* 返回相交的信息，后续的分析要用 */
+        }
+        return Lo;
+    }
 
     /**
      * 入射光线主要有两个来源：
      *  1. 来自于光源（通过对光源的采样来计算这一部分的值）
      *  2. 来自于其他物体（通过在半球空间采样来计算这一部分的值）
+     * 沿着路径向前走，throughput 是路径上各个节点 weight 的乘积
+     * 不记录路径时，只需要 throughput，路径长度的上限仍然和 PathBuffer 的容量一致
      */
+    Eigen::Vector3f radiance{0.f, 0.f, 0.f};
+    Eigen::Vector3f throughput{1.f, 1.f, 1.f};
+    Ray ray = camera_ray;
+
+    /* 训练路径引导时，记录每个节点的采样信息，路径结束后才能知道每个节点的入射 radiance */
+    struct GuidingVertex {
+        Eigen::Vector3f pos;
+        Eigen::Vector3f wi;
+        float pdf;
+        Eigen::Vector3f throughput;     /* 从摄像机到下一个节点的 throughput */
+        Eigen::Vector3f radiance;       /* 采样 wi 之前，这条光路已经得到的 radiance */
+    };
+    std::array<GuidingVertex, PathBuffer::CAPACITY> guiding_vertices;
+    int guiding_cnt = 0;
+
+    /* 使用 radiance 缓存时，记录需要插入缓存的节点，路径结束后才能知道每个节点的出射 radiance */
+    struct CacheVertex {
+        Eigen::Vector3f pos;
+        Eigen::Vector3f normal;
+        Eigen::Vector3f throughput;     /* 从摄像机到这个节点的 throughput */
+        Eigen::Vector3f radiance;       /* 到达这个节点之前，这条光路已经得到的 radiance */
+    };
+    std::array<CacheVertex, PathBuffer::CAPACITY> cache_vertices;
+    int cache_cnt = 0;
+    const bool use_cache = _cache_active();
 
-    /* 路径信息 */
-    PathNode node;
-    node.Lo      = Eigen::Vector3f(0.f, 0.f, 0.f);
-    node.wo      = -ray.direction();
-    node.pos_out = ray.origin();
-    node.inter   = inter;
-
-    // =========================================================
-    // 1. 向光源投射光线
-    // =========================================================
-    RUN_ONCE
+    for (int depth = 1;; ++depth)
     {
-        // 在场景中的光源进行随机采样
-        auto [pdf_light, inter_light] = _scene->sample_light();
+        assert(inter.happened());
+        assert(!inter.mat()->is_emission());
 
-        // 如果场景中并没有光源：
-        if (!inter_light.happened())
+        /* 路径信息 */
+        PathNode *node = nullptr;
+        if constexpr (CaptureT_::RECORD_PATH)
         {
-            node.set_light_inter(Eigen::Vector3f(0.f, 0.f, 0.f), Direction::zero(), Intersection::no_intersect());
-            break;
+            node          = &buffer.push();
+            node->wo      = -ray.direction();
+            node->pos_out = ray.origin();
+            node->inter   = inter;
         }
-        assert(inter_light.mat()->is_emission());
 
-        // 判断到光源采样点的路上是否有被遮挡
-        // 构造光线时，让原点在法线方向上又一个偏移，防止与自身相交
-        Ray ray_to_light{inter.pos() + inter.normal().get() * OFFSET, inter_light.pos() - inter.pos()};
-        // 由于光线的原点有了偏移，终点也会出现偏移
-        float delta;
-        {
-            float _cos_theta  = inter.normal().get().dot(ray_to_light.direction().get());
-            float _cos_theta1 = inter_light.normal().get().dot(-ray_to_light.direction().get());
-            delta             = OFFSET * std::sqrt(1 - _cos_theta * _cos_theta) / _cos_theta1;
-        }
-        Intersection inter_light_dir = _scene->intersect(ray_to_light);
-        if ((inter_light_dir.pos() - inter_light.pos()).norm() > delta + epsilon_4)
+        if (use_cache && depth >= cache->options().min_depth && inter.mat()->is_diffuse())
+            cache_vertices[cache_cnt++] = {inter.pos(), inter.normal().get(), throughput, radiance};
+
+        // =========================================================
+        // 1. 向光源投射光线
+        // =========================================================
+        Eigen::Vector3f L_light =
+                shade_light<CaptureT_>(ray, inter, node, integrator.light_sampling == LightSampling::MIS);
+        radiance += throughput.cwiseProduct(L_light);
+        if constexpr (CaptureT_::RECORD_PATH)
+            node->Lo = L_light;
+
+        // =========================================================
+        // 2. 向其他物体投射光线
+        // =========================================================
+        // 俄罗斯轮盘赌测试；路径达到长度上限，也截断路径
+        float RR   = random_float_get();
+        float P_RR = depth >= PathBuffer::CAPACITY ? 0.f : integrator.termination.survival_probability(depth, throughput);
+        if (RR >= P_RR)
         {
-            node.set_light_inter(Eigen::Vector3f(0.f, 0.f, 0.f), ray_to_light.direction(), inter_light_dir);
+            if constexpr (CaptureT_::RECORD_PATH)
+                node->set_obj_inter(RR, Direction::zero(), Intersection::no_intersect());
             break;
         }
 
-        // 计算反射方程
-        Eigen::Vector3f Lo_light =
-                reflect_equation_light(inter, inter_light, ray_to_light.direction(), -ray.direction(), pdf_light);
-
-        // 添加路径信息
-        node.Lo += Lo_light;
-        node.set_light_inter(inter_light.mat()->emission(), ray_to_light.direction(), inter_light);
-    }
-
-    // =========================================================
-    // 2. 向其他物体投射光线
-    // =========================================================
-    RUN_ONCE
-    {
-        // 俄罗斯轮盘赌测试
-        float RR = random_float_get();
-        if (RR > RussianRoulette)
+        // 采样下一段光路的方向：BSDF 采样，或者和路径引导混合
+        auto [wi_obj, pdf_obj, fr] = _scatter_sample(ray, inter);
+        float cos_theta = inter.normal().get().dot(wi_obj.get());
+        if (pdf_obj <= 0.f || cos_theta <= 0.f)
         {
-            node.set_obj_inter(RR, Direction::zero(), Intersection::no_intersect());
+            // 路径引导可能采样到表面以下的方向，这个方向没有贡献
+            if constexpr (CaptureT_::RECORD_PATH)
+                node->set_obj_inter(RR, Direction::zero(), Intersection::no_intersect());
             break;
         }
-
-        // 使用半球随机采样
-        auto [pdf_obj, wi_obj] = Material::sample_himsphere_random(inter.normal());
         // 让光线原点沿法线偏移
         Ray ray_to_obj{inter.pos() + inter.normal().get() * OFFSET, wi_obj};
         Intersection inter_with_obj = _scene->intersect(ray_to_obj);
 
-        // 是否发生相交
+        // 下一段光路对当前节点的贡献系数
+        Eigen::Vector3f w = fr * cos_theta / pdf_obj / P_RR;
+        if (_guiding_record)
+            guiding_vertices[guiding_cnt++] = {inter.pos(), wi_obj.get(), pdf_obj, throughput.cwiseProduct(w), radiance};
+
+        // 没有发生相交，或者是发光体（已经对发光体进行过采样了）
+        if constexpr (CaptureT_::RECORD_PATH)
+        {
+            node->set_obj_inter(RR, wi_obj, inter_with_obj);
+            node->from_obj.weight = cos_theta / pdf_obj / P_RR;
+        }
         if (!inter_with_obj.happened())
+            break;
+        if (inter_with_obj.mat()->is_emission())
         {
-            node.set_obj_inter(RR, wi_obj, inter_with_obj);
+            // MIS：击中光源的正面时，按照 BSDF 采样的权重计入光源的贡献
+            bool front_face = inter_with_obj.normal().get().dot(wi_obj.get()) < 0.f;
+            if (integrator.light_sampling == LightSampling::MIS && front_face)
+            {
+                float pdf_light = pdf_area_to_solid_angle(_scene->pdf_light(inter_with_obj), inter.pos(),
+                                                          inter_with_obj, wi_obj);
+                float mis_weight       = power_heuristic(pdf_obj, pdf_light);
+                Eigen::Vector3f L_emit = inter_with_obj.mat()->emission() * mis_weight;
+                radiance += throughput.cwiseProduct(w).cwiseProduct(L_emit);
+                if constexpr (CaptureT_::RECORD_PATH)
+                {
+                    node->from_obj.mis    = mis_weight;
+                    node->from_obj.Li_obj = L_emit;
+                    node->Lo += L_emit.cwiseProduct(w);
+                }
+            }
             break;
         }
 
-        // 是否为发光体，已经对发光体进行过采样了
-        if (inter_with_obj.mat()->is_emission())
+        // 查询 radiance 缓存：命中时，缓存的出射 radiance 代替之后的路径
+        Eigen::Vector3f L_cache;
+        if (use_cache && depth + 1 >= cache->options().min_depth && inter_with_obj.mat()->is_diffuse() &&
+            cache->query(inter_with_obj.pos(), inter_with_obj.normal(), L_cache))
         {
-            node.set_obj_inter(RR, wi_obj, inter_with_obj);
+            radiance += throughput.cwiseProduct(w).cwiseProduct(L_cache);
+            if constexpr (CaptureT_::RECORD_PATH)
+            {
+                node->from_obj.Li_obj = L_cache;
+                node->Lo += L_cache.cwiseProduct(w);
+            }
             break;
         }
 
+        throughput = throughput.cwiseProduct(w);
+        if constexpr (CaptureT_::RECORD_PATH)
+            buffer.weight(buffer.size() - 1) = w;
+
         // 计算下一段光路
-        RTRender::cast_ray_recursive(ray_to_obj, inter_with_obj, path);
-        assert(!path.empty());
+        ray   = ray_to_obj;
+        inter = inter_with_obj;
+    }
+
+    /* 每个节点沿 wi 的入射 radiance：之后得到的 radiance 除以到下一个节点的 throughput */
+    for (int i = 0; i < guiding_cnt; ++i)
+    {
+        const GuidingVertex &v = guiding_vertices[i];
+        Eigen::Vector3f Li = (radiance - v.radiance).cwiseQuotient(v.throughput.cwiseMax(1e-8f));
+        guiding->record(v.pos, Direction(v.wi), luminance(Li) / v.pdf);
+    }
 
-        // 计算和物体相交的反射方程
-        Eigen::Vector3f Li_obj    = path.front().Lo;
-        Eigen::Vector3f fr        = inter.mat()->brdf_phong(wi_obj, -ray.direction(), inter.normal());
-        float cos_theta           = std::max(0.f, inter.normal().get().dot(wi_obj.get()));
-        Eigen::Vector3f Lo_object = Li_obj.array() * fr.array() * cos_theta / pdf_obj / RussianRoulette;
+    /* 每个节点的出射 radiance：之后得到的 radiance 除以到这个节点的 throughput */
+    for (int i = 0; i < cache_cnt; ++i)
+    {
+        const CacheVertex &v = cache_vertices[i];
+        Eigen::Vector3f Lo = (radiance - v.radiance).cwiseQuotient(v.throughput.cwiseMax(1e-8f));
+        cache->insert(v.pos, Direction(v.normal), Lo);
+    }
 
-        // 添加路径信息
-        node.Lo += Lo_object;
-        node.set_obj_inter(RR, wi_obj, inter_with_obj, Li_obj);
+    /* 从路径末端向摄像机回溯，补全每个节点的 Lo 和来自物体的 Li */
+    if constexpr (CaptureT_::RECORD_PATH)
+    {
+        for (int i = buffer.size() - 2; i >= 0; --i)
+        {
+            Eigen::Vector3f Li_obj = buffer[i + 1].Lo;
+            buffer[i].from_obj.Li_obj = Li_obj;
+            buffer[i].Lo += Li_obj.cwiseProduct(buffer.weight(i));
+        }
     }
 
-    path.push_front(std::move(node));
+    return radiance;
 }
 
-std::deque<PathNode> RTRender::cast_ray(const Ray &ray)
-{
-    Intersection inter = _scene->intersect(ray);
 
-    /**
-     * 从摄像机射出一根光线，有三种情况
-     *  1. 不和任何物体相交
-     *  2. 和发光体相交，返回相交的信息
-     *      （因为这里使用了单独的对光源采样，所以需要单独处理这种情况）
-     *  3. 和不发光的物体相交，递归地计算光路
-     */
+Eigen::Vector3f RTRender::shade_preview(const Ray &ray, const Intersection &primary)
+{
+    if (!primary.happened())
+        return {0.f, 0.f, 0.f};
 
-    /* 不和任何物体相交 */
-    if (!inter.happened())
+    switch (integrator.type)
     {
-        PathNode node;
-        node.Lo      = Eigen::Vector3f(0.f, 0.f, 0.f);
-        node.wo      = -ray.direction();
-        node.pos_out = ray.origin();
-        node.inter   = inter; /* 返回相交的信息，后续的分析要用 */
-        return {std::move(node)};
+        case IntegratorType::AmbientOcclusion:
+        {
+            /* 按照余弦加权采样，没有被遮挡的光线比例就是 AO 的估计值 */
+            float radius = integrator.ao_radius > 0.f ? integrator.ao_radius : std::numeric_limits<float>::infinity();
+            int visible  = 0;
+            for (int i = 0; i < integrator.ao_samples; ++i)
+            {
+                auto [pdf, wi] = Material::sample_himsphere_cosine(primary.normal());
+                Ray ray_ao{primary.pos() + primary.normal().get() * OFFSET, wi};
+                if (!_scene->occluded(ray_ao, radius))
+                    ++visible;
+            }
+            float ao = (float) visible / (float) std::max(1, integrator.ao_samples);
+            return {ao, ao, ao};
+        }
+        case IntegratorType::Normal:
+            return (primary.normal().get() + Eigen::Vector3f(1.f, 1.f, 1.f)) * 0.5f;
+        case IntegratorType::Albedo:
+            return primary.mat()->albedo();
+        case IntegratorType::Depth:
+        {
+            float depth = 1.f - primary.t_near() / _scene->bounding_box().diagonal().norm();
+            depth       = std::clamp(depth, 0.f, 1.f);
+            return {depth, depth, depth};
+        }
+        case IntegratorType::DirectLighting:
+            if (primary.mat()->is_emission())
+                return primary.mat()->emission();
+            return shade_light<NoCapture>(ray, primary, nullptr, false);
+        case IntegratorType::InstantRadiosity:
+            if (primary.mat()->is_emission())
+                return primary.mat()->emission();
+            return shade_vpl(ray, primary);
+        default: throw std::runtime_error("never");
     }
+}
+
 
-    /* 与发光体相交 */
-    if (inter.mat()->is_emission())
+/**
+ * VPL 的贡献：weight * BRDF(x) * cos_x * cos_y / d^2
+ * 距离限制在 min_distance 以上，避免 VPL 附近出现亮斑
+ */
+Eigen::Vector3f RTRender::shade_vpl(const Ray &ray, const Intersection &inter)
+{
+    const float min_distance = integrator.vpl.min_distance > 0.f
+                               ? integrator.vpl.min_distance
+                               : _scene->bounding_box().diagonal().norm() / 20.f;
+    const Eigen::Vector3f origin = inter.pos() + inter.normal().get() * OFFSET;
+
+    Eigen::Vector3f L{0.f, 0.f, 0.f};
+    for (const VPL &vpl : vpls)
     {
-        PathNode node;
-        node.Lo      = inter.mat()->emission();
-        node.wo      = -ray.direction();
-        node.pos_out = ray.origin();
-        node.inter   = inter;
-        return {std::move(node)};
+        Eigen::Vector3f d = vpl.pos - origin;
+        float dist2 = d.squaredNorm();
+        if (dist2 <= 0.f)
+            continue;
+        Direction wi(d);
+        float cos_x = inter.normal().get().dot(wi.get());
+        float cos_y = -vpl.normal.get().dot(wi.get());
+        if (cos_x <= 0.f || cos_y <= 0.f)
+            continue;
+
+        // VPL 在表面上，和光源采样点一样，线段的终点留出 OFFSET
+        if (_scene->occluded(Ray{origin, wi}, std::sqrt(dist2) - OFFSET))
+            continue;
+
+        float G = cos_x * cos_y / std::max(dist2, min_distance * min_distance);
+        L += vpl.weight.cwiseProduct(inter.mat()->brdf_phong(wi, -ray.direction(), inter.normal())) * G;
     }
+    return L;
+}
+
+
+std::deque<PathNode> RTRender::cast_ray(const Ray &ray)
+{
+    thread_local PathBuffer buffer;
+    trace_path<FullPath>(ray, buffer);
+    return {buffer.begin(), buffer.end()};
+}
+
+
+std::deque<PathNode> RTRender::reconstruct_path(int col, int row, int sample)
+{
+    assert(col >= 0 && col < _scene->screen_width() && row >= 0 && row < _scene->screen_height());
+    auto [ray, primary] = _primary_get(col, row, sample);
+    _sample_seed_set(col, row, sample);
 
-    /* 和不发光的物体相交 */
-    std::deque<PathNode> path{};
-    cast_ray_recursive(ray, inter, path);
-    return path;
+    thread_local PathBuffer buffer;
+    trace_path<FullPath>(ray, primary, buffer);
+    return {buffer.begin(), buffer.end()};
 }
 
 
@@ -211,27 +535,146 @@ std::vector<RTRender::RenderPixelTask> RTRender::_prepare_render_task(const std:
     std::vector<RenderPixelTask> task_list;
     task_list.reserve(scene->screen_height() * scene->screen_width());
 
+    for (int row = 0; row < scene->screen_height(); ++row)
+    {
+        for (int col = 0; col < scene->screen_width(); ++col)
+            task_list.push_back(_prepare_pixel_task(scene, col, row));
+    }
+
+    return task_list;
+}
+
+
+RTRender::RenderPixelTask RTRender::_prepare_pixel_task(const std::shared_ptr<Scene> &scene, int col, int row,
+                                                        const Eigen::Vector2f &offset)
+{
     /* 设 view 平面位于摄像机前 1.0 处，根据 fov 和 aspect 计算出 view 平面的长和宽 */
     float view_height = 2.f * (float) std::tan(scene->fov() / 2.f / 180.f * M_PI);
     float view_width  = view_height / (float) scene->screen_height() * (float) scene->screen_height();
 
-    for (int row = 0; row < scene->screen_height(); ++row)
-    {
-        for (int col = 0; col < scene->screen_width(); ++col)
+    /* 像素点在摄像机坐标系中的 x 坐标和 y 坐标 */
+    float view_x = (((float) col + offset.x()) / (float) scene->screen_width() - 0.5f) * view_width;
+    float view_y = (0.5f - ((float) row + offset.y()) / (float) scene->screen_height()) * view_height;
+
+    /* 像素点在 global 坐标系中的位置 */
+    Eigen::Vector4f dir_global = scene->view_to_global({view_x, view_y, -1.f, 0.f});
+
+    Ray ray(scene->camera_pos(), dir_global.head(3));
+    return RenderPixelTask{col, row, ray};
+}
+
+
+/**
+ * 主光线的可见性计算
+ *  \_ 跳过已经计算过的像素，剩下的像素按照小区块排序，区块的像素数量和光线包的宽度相同
+ *  \_ 相邻的 RAY_PACKET_WIDTH 个像素（通常就是一个区块）的同一个子像素偏移组成一个光线包，一起遍历 BVH
+ *  \_ 光线包的划分只由任务列表决定，和线程数量无关
+ */
+void RTRender::_build_gbuffer(const std::vector<RenderPixelTask> &task_list, unsigned thread_cnt)
+{
+    int offset_cnt = std::max(1, integrator.primary_offsets);
+    if (gbuffer.width() != _scene->screen_width() || gbuffer.height() != _scene->screen_height() ||
+        gbuffer.offset_cnt() != offset_cnt)
+        gbuffer = GBuffer(_scene->screen_width(), _scene->screen_height(), offset_cnt);
+
+    /* 区块的大小：2 行，每行 RAY_PACKET_WIDTH / 2 个像素 */
+    constexpr int tile_w = RAY_PACKET_WIDTH / 2, tile_h = 2;
+    auto tile_key = [](const RenderPixelTask *task) {
+        return std::make_tuple(task->row / tile_h, task->col / tile_w, task->row, task->col);
+    };
+    std::vector<const RenderPixelTask *> pending;
+    pending.reserve(task_list.size());
+    for (const auto &task : task_list)
+        if (!gbuffer.ready(task.row, task.col))
+            pending.push_back(&task);
+    std::sort(pending.begin(), pending.end(), [&](auto *a, auto *b) { return tile_key(a) < tile_key(b); });
+    pending.erase(std::unique(pending.begin(), pending.end(),
+                              [](auto *a, auto *b) { return a->row == b->row && a->col == b->col; }),
+                  pending.end());
+
+    size_t packet_cnt = (pending.size() + RAY_PACKET_WIDTH - 1) / RAY_PACKET_WIDTH;
+    parallel_for(packet_cnt, thread_cnt, 16, [&](size_t packet_idx) {
+        size_t begin = packet_idx * RAY_PACKET_WIDTH;
+        int lane_cnt = (int) std::min((size_t) RAY_PACKET_WIDTH, pending.size() - begin);
+
+        for (int k = 0; k < offset_cnt; ++k)
         {
-            /* 像素点在摄像机坐标系中的 x 坐标和 y 坐标 */
-            float view_x = (((float) col + 0.5f) / (float) scene->screen_width() - 0.5f) * view_width;
-            float view_y = (0.5f - ((float) row + 0.5f) / (float) scene->screen_height()) * view_height;
+            RayPacket<RAY_PACKET_WIDTH> packet;
+            for (int lane = 0; lane < lane_cnt; ++lane)
+            {
+                const RenderPixelTask &task = *pending[begin + lane];
+                packet.set(lane, _prepare_pixel_task(_scene, task.col, task.row, GBuffer::jitter_offset(k)).ray);
+            }
+
+            PacketHit<RAY_PACKET_WIDTH> hit;
+            _scene->intersect(packet, hit);
+            for (int lane = 0; lane < lane_cnt; ++lane)
+                gbuffer.at(pending[begin + lane]->row, pending[begin + lane]->col, k) = hit.inter[lane];
+        }
+        for (int lane = 0; lane < lane_cnt; ++lane)
+            gbuffer.set_ready(pending[begin + lane]->row, pending[begin + lane]->col);
+    });
+}
 
-            /* 像素点在 global 坐标系中的位置 */
-            Eigen::Vector4f dir_global = scene->view_to_global({view_x, view_y, -1.f, 0.f});
 
-            Ray ray(scene->camera_pos(), dir_global.head(3));
-            task_list.push_back(RenderPixelTask{col, row, ray});
+std::tuple<Ray, Intersection> RTRender::_primary_get(int col, int row, int sample)
+{
+    /* 没有 gbuffer 时，采样和 gbuffer 只有一个偏移时相同 */
+    int offset = gbuffer.empty() ? 0 : gbuffer.offset_of(sample);
+    Ray ray    = _prepare_pixel_task(_scene, col, row, GBuffer::jitter_offset(offset)).ray;
+    if (gbuffer.ready(row, col))
+        return {ray, gbuffer.at(row, col, offset)};
+    return {ray, _scene->intersect(ray)};
+}
+
+
+std::vector<RTRender::RenderTile> RTRender::_prepare_render_tiles(const std::shared_ptr<Scene> &scene,
+                                                                  int tile_size, TileOrder tile_order)
+{
+    assert(tile_size > 0);
+    std::vector<RenderPixelTask> task_list = _prepare_render_task(scene);
+
+    int width   = scene->screen_width();
+    int height  = scene->screen_height();
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+
+    /* Hilbert 曲线需要边长为 2 的幂的网格 */
+    uint32_t grid = 1;
+    while (grid < (uint32_t) std::max(tiles_x, tiles_y))
+        grid *= 2;
+
+    /* 计算每个区块在曲线上的序号，按照序号排序 */
+    std::vector<std::pair<uint32_t, std::pair<int, int>>> keys;
+    for (int ty = 0; ty < tiles_y; ++ty)
+    {
+        for (int tx = 0; tx < tiles_x; ++tx)
+        {
+            uint32_t key;
+            switch (tile_order)
+            {
+                case TileOrder::Scanline: key = ty * tiles_x + tx; break;
+                case TileOrder::Morton: key = morton_encode_2d(tx, ty); break;
+                case TileOrder::Hilbert: key = hilbert_index_2d(grid, tx, ty); break;
+                default: throw std::runtime_error("never");
+            }
+            keys.push_back({key, {ty, tx}});
         }
     }
+    std::sort(keys.begin(), keys.end());
 
-    return task_list;
+    std::vector<RenderTile> tiles;
+    tiles.reserve(keys.size());
+    for (auto &[key, tile_pos] : keys)
+    {
+        auto [ty, tx] = tile_pos;
+        RenderTile tile;
+        for (int row = ty * tile_size; row < std::min((ty + 1) * tile_size, height); ++row)
+            for (int col = tx * tile_size; col < std::min((tx + 1) * tile_size, width); ++col)
+                tile.tasks.push_back(task_list[row * width + col]);
+        tiles.push_back(std::move(tile));
+    }
+    return tiles;
 }
 
 
@@ -244,23 +687,31 @@ std::vector<RTRender::RenderPixelTask> RTRender::_prepare_render_task(const std:
  *  \main 还负责更新任务进度
  */
 void RTRender::render_multi_thread(const std::string &db_path, int worker_cnt, int worker_buffer_size,
-                                   int worker_sleep_ms, int master_process_interval)
+                                   int worker_sleep_ms, int master_process_interval, int tile_size,
+                                   TileOrder tile_order, CaptureMode capture)
 {
+    bool use_db  = capture != CaptureMode::None;
+    PixelJob job = pixel_job(capture);
+
 
-    /* 创建任务列表以及保护任务列表的互斥量 */
+    /* 创建任务列表以及保护任务列表的互斥量；worker 从列表尾部取任务，所以将区块倒序存放 */
     std::mutex task_mtx;
-    auto task_list        = _prepare_render_task(_scene);
+    _build_gbuffer(_prepare_render_task(_scene), worker_cnt);
+    auto task_list = _prepare_render_tiles(_scene, tile_size, tile_order);
+    std::reverse(task_list.begin(), task_list.end());
     size_t total_task_cnt = task_list.size();
 
     /* 创建结果列表以及保护结果列表的互斥量 */
     std::mutex res_mtx;
-    std::vector<std::shared_ptr<RenderPixelResult>> res_list;
+    std::vector<RenderTileResult> res_list;
 
     /* 初始化 worker */
-    std::vector<Worker<RenderPixelTask, std::shared_ptr<RenderPixelResult>>> workers(
+    std::vector<Worker<RenderTile, RenderTileResult>> workers(
             worker_cnt,
-            Worker<RenderPixelTask, std::shared_ptr<RenderPixelResult>>(
-                    task_list, task_mtx, res_list, res_mtx, jobRenderOnePixel, worker_buffer_size, worker_sleep_ms));
+            Worker<RenderTile, RenderTileResult>(
+                    task_list, task_mtx, res_list, res_mtx,
+                    [this, job](const RenderTile &tile) { return jobRenderOneTile(tile, job); },
+                    worker_buffer_size, worker_sleep_ms));
 
     /* 让 worker 运行 */
     for (auto &worker: workers)
@@ -268,9 +719,10 @@ void RTRender::render_multi_thread(const std::string &db_path, int worker_cnt, i
     fmt::print("\n");
 
     /* 连接到数据库，清空旧数据 */
-    DB::init_db(db_path);
-    sqlite3_exec(DB::db, "DELETE FROM node", nullptr, nullptr, nullptr);
-    sqlite3_exec(DB::db, "DELETE FROM path", nullptr, nullptr, nullptr);
+    if (use_db)
+    {
+        _db_open(db_path);
+    }
 
     /* 直到所有 result 都被处理过，才会停止 */
     size_t processed_res_cnt = 0; /* 已经处理过的结果数量 */
@@ -286,23 +738,29 @@ void RTRender::render_multi_thread(const std::string &db_path, int worker_cnt, i
 
         auto start = std::chrono::system_clock::now();
         /* 将 res_list 的数据转移到 res_buffer 中 */
-        std::vector<std::shared_ptr<RenderPixelResult>> res_buffer;
+        std::vector<RenderTileResult> res_buffer;
         {
             std::lock_guard<std::mutex> lck(res_mtx);
             res_buffer.insert(res_buffer.end(), res_list.begin(), res_list.end());
             res_list.clear();
         }
 
-        DB::transaction_begin();
-        for (const auto &res: res_buffer)
+        if (use_db)
+            DB::transaction_begin(_db);
+        for (const auto &tile_res: res_buffer)
         {
-            /* 将光路信息写入 framebuffer */
-            drawFrameBuffer(res);
-
-            /* 将光路信息写入数据库 */
-            insert_pixel_ray(DB::db, *res);
+            for (const auto &res: tile_res)
+            {
+                /* 将光路信息写入 framebuffer */
+                drawFrameBuffer(res);
+
+                /* 将光路信息写入数据库 */
+                if (use_db)
+                    insert_pixel_ray(_db, *res);
+            }
         }
-        DB::transaction_commit();
+        if (use_db)
+            DB::transaction_commit(_db);
         processed_res_cnt += res_buffer.size();
 
         /* 这一轮的处理时间没有达到设定的时间，就睡过去 */
@@ -312,14 +770,15 @@ void RTRender::render_multi_thread(const std::string &db_path, int worker_cnt, i
             std::this_thread::sleep_for(std::chrono::milliseconds(master_process_interval - time_delta));
 
         /* 更新进度 */
-        fmt::print("\rtasks: ({} / {}), result: ({}/{})", task_list.size(), total_task_cnt, processed_res_cnt,
+        fmt::print("\rtiles: ({} / {}), result: ({}/{})", task_list.size(), total_task_cnt, processed_res_cnt,
                    total_task_cnt);
         fflush(stdout);
     }
     fmt::print("\n");
 
     /* 关闭数据库 */
-    DB::close_db();
+    if (use_db)
+        _db_close();
 
     /* 关闭所有的 worker */
     for (auto &worker: workers)
@@ -327,59 +786,144 @@ void RTRender::render_multi_thread(const std::string &db_path, int worker_cnt, i
 }
 
 
-void RTRender::render_atomic(const std::string &db_path)
+/**
+ * 只渲染一个矩形区域：展开为区域内的像素，交给 render_pixels
+ */
+void RTRender::render_region(const std::string &db_path, const PixelRect &rect, bool render_others,
+                             CaptureMode capture)
 {
-    using task_list_t = std::vector<RenderPixelTask>;
-    using res_list_t  = std::vector<std::shared_ptr<RenderPixelResult>>;
+    std::vector<std::pair<int, int>> pixels;
+    pixels.reserve((size_t) std::max(0, rect.width) * std::max(0, rect.height));
+    for (int row = rect.row; row < rect.row + rect.height; ++row)
+    {
+        for (int col = rect.col; col < rect.col + rect.width; ++col)
+            pixels.emplace_back(col, row);
+    }
+    render_pixels(db_path, pixels, render_others, capture);
+}
+
 
+/**
+ * 只渲染若干个像素
+ *  \_ 需要记录的像素按照 capture 渲染，光路信息在一个事务中写入数据库
+ *  \_ render_others 时，其余的像素以 CaptureMode::None 渲染，只更新 framebuffer
+ */
+void RTRender::render_pixels(const std::string &db_path, const std::vector<std::pair<int, int>> &pixels,
+                             bool render_others, CaptureMode capture)
+{
+    int width               = _scene->screen_width();
+    int height              = _scene->screen_height();
     unsigned int thread_cnt = std::thread::hardware_concurrency();
 
-    task_list_t task_list = _prepare_render_task(_scene);
-    size_t task_size      = task_list.size();
+    /* 标记需要记录的像素，跳过重复的像素和画面之外的像素 */
+    std::vector<bool> captured(width * height, false);
+    std::vector<RenderPixelTask> task_list;
+    for (auto [col, row]: pixels)
+    {
+        if (col < 0 || col >= width || row < 0 || row >= height || captured[row * width + col])
+            continue;
+        captured[row * width + col] = true;
+        task_list.push_back(_prepare_pixel_task(_scene, col, row));
+    }
+
+    /* 渲染需要记录的像素 */
+    _build_gbuffer(task_list, thread_cnt);
+    PixelJob job = pixel_job(capture);
+    std::vector<std::shared_ptr<RenderPixelResult>> res_list(task_list.size());
+    parallel_for(task_list.size(), thread_cnt, 1, [&](size_t i) { res_list[i] = (this->*job)(task_list[i]); });
+
+    /* 其他像素不记录光路信息，每个线程写入的是不同的像素，不需要加锁 */
+    if (render_others)
+    {
+        std::vector<RenderPixelTask> all_tasks = _prepare_render_task(_scene);
+        PixelJob job_none                      = pixel_job(CaptureMode::None);
+        _build_gbuffer(all_tasks, thread_cnt);
+        parallel_for(all_tasks.size(), thread_cnt, 64, [&](size_t i) {
+            if (!captured[i])
+                drawFrameBuffer((this->*job_none)(all_tasks[i]));
+        });
+    }
+
+    /* 只将区域内的光路写入数据库 */
+    bool use_db = capture != CaptureMode::None;
+    if (use_db)
+    {
+        _db_open(db_path);
+        DB::transaction_begin(_db);
+    }
+    for (const auto &res: res_list)
+    {
+        drawFrameBuffer(res);
+        if (use_db)
+            insert_pixel_ray(_db, *res);
+    }
+    if (use_db)
+    {
+        DB::transaction_commit(_db);
+        _db_close();
+    }
+}
+
+
+/**
+ * 使用多线程来进行渲染，线程之间没有锁
+ *  \_ 画面切分成区块，按照空间填充曲线排列；线程通过原子计数器领取下一个区块
+ *  \_ 线程将一个区块的结果一起写入双缓冲的结果数组，主线程定期交换缓冲，并将结果写入数据库
+ */
+void RTRender::render_atomic(const std::string &db_path, int tile_size, TileOrder tile_order, CaptureMode capture)
+{
+    bool use_db  = capture != CaptureMode::None;
+    PixelJob job = pixel_job(capture);
+
+    using res_list_t = std::vector<std::shared_ptr<RenderPixelResult>>;
+
+    unsigned int thread_cnt = ThreadPool::shared().size();
+
+    _build_gbuffer(_prepare_render_task(_scene), thread_cnt);
+    std::vector<RenderTile> tile_list = _prepare_render_tiles(_scene, tile_size, tile_order);
+    size_t task_size                  = _scene->screen_width() * _scene->screen_height();
+    std::atomic<size_t> next_tile     = 0;
 
     std::array<res_list_t, 2> res_list;
     int res_front_idx = 0;
     int res_back_idx  = 1;
 
-    std::atomic<bool> task_list_busy = false;
-    std::atomic<bool> res_list_busy  = false;
+    std::atomic<bool> res_list_busy = false;
 
     auto thread_func = [&]() {
-        while (!task_list.empty())
+        while (true)
         {
-            // 取任务
-            bool temp = false;
-            while (!task_list_busy.compare_exchange_weak(temp, true, std::memory_order_relaxed))
-                temp = false;
-            RenderPixelTask task = task_list.back();
-            task_list.pop_back();
-            task_list_busy.store(false, std::memory_order_release);
+            // 领取区块
+            size_t tile_idx = next_tile.fetch_add(1, std::memory_order_relaxed);
+            if (tile_idx >= tile_list.size())
+                break;
 
 
             // 执行任务
-            std::shared_ptr<RenderPixelResult> result = jobRenderOnePixel(task);
+            RenderTileResult result = jobRenderOneTile(tile_list[tile_idx], job);
 
 
             // 写入结果数组
-            temp = false;
-            while (!res_list_busy.compare_exchange_weak(temp, true, std::memory_order_relaxed))
+            bool temp = false;
+            while (!res_list_busy.compare_exchange_weak(temp, true, std::memory_order_acquire))
                 temp = false;
-            res_list[res_front_idx].push_back(result);
+            res_list[res_front_idx].insert(res_list[res_front_idx].end(), result.begin(), result.end());
             res_list_busy.store(false, std::memory_order_release);
         }
     };
 
 
-    // 启动所有线程
-    std::vector<std::thread> threads;
-    for (int i = 0; i < thread_cnt; ++i)
-        threads.emplace_back(thread_func);
+    // 在共享的线程池中启动所有任务
+    std::vector<std::future<void>> threads;
+    for (unsigned i = 0; i < thread_cnt; ++i)
+        threads.push_back(ThreadPool::shared().submit(thread_func));
 
 
     // 连接到数据库，清空旧数据
-    DB::init_db(db_path);
-    sqlite3_exec(DB::db, "DELETE FROM node", nullptr, nullptr, nullptr);
-    sqlite3_exec(DB::db, "DELETE FROM path", nullptr, nullptr, nullptr);
+    if (use_db)
+    {
+        _db_open(db_path);
+    }
 
     fmt::print("\n");
     size_t task_ok_cnt = 0;
@@ -389,85 +933,875 @@ void RTRender::render_atomic(const std::string &db_path)
 
         // swap result list
         bool temp = false;
-        while (!res_list_busy.compare_exchange_weak(temp, true, std::memory_order_relaxed))
+        while (!res_list_busy.compare_exchange_weak(temp, true, std::memory_order_acquire))
             temp = false;
         std::swap(res_front_idx, res_back_idx);
         res_list_busy.store(false, std::memory_order_release);
 
 
         // 存储结果
-        DB::transaction_begin();
+        if (use_db)
+            DB::transaction_begin(_db);
         for (const auto &res: res_list[res_back_idx])
         {
             drawFrameBuffer(res);
-            insert_pixel_ray(DB::db, *res);
+            if (use_db)
+                insert_pixel_ray(_db, *res);
         }
-        DB::transaction_commit();
+        if (use_db)
+            DB::transaction_commit(_db);
 
 
         task_ok_cnt += res_list[res_back_idx].size();
         res_list[res_back_idx].clear();
-        fmt::print("\rtasks: {}/{}, result: {}/{}", task_list.size(), task_size, task_ok_cnt, task_size);
+        fmt::print("\rtiles: {}/{}, result: {}/{}", std::min(next_tile.load(), tile_list.size()), tile_list.size(),
+                   task_ok_cnt, task_size);
         fflush(stdout);
     }
 
 
     for (auto &thread: threads)
-        thread.join();
-    DB::close_db();
+        thread.wait();
+    if (use_db)
+        _db_close();
+}
+
+
+void RTRender::wavefront_shade(WavefrontPath &path, WavefrontShadowRay &shadow)
+{
+    const Intersection &inter = path.inter;
+
+    /* 没有交点，或者与发光体相交：只有摄像机直接看到的发光体需要计入，其余的已经通过光源采样计算过了 */
+    if (!inter.happened() || inter.mat()->is_emission())
+    {
+        if (inter.happened() && path.depth == 0)
+            path.radiance += inter.mat()->emission();
+        path.alive = false;
+        return;
+    }
+
+    /* 对光源采样，生成 shadow ray，贡献值在光源可见时才会计入 */
+    auto [pdf_light, inter_light] = _scene->sample_light();
+    if (inter_light.happened())
+    {
+        Ray ray_to_light    = shadow_ray_get(inter, inter_light, shadow.t_max);
+        shadow.valid        = true;
+        shadow.origin       = ray_to_light.origin();
+        shadow.direction    = ray_to_light.direction();
+        shadow.contribution = path.throughput.cwiseProduct(reflect_equation_light(
+                inter, inter_light, Direction(inter_light.pos() - inter.pos()), -path.ray.direction(), pdf_light));
+    }
+
+    /* 俄罗斯轮盘赌，路径长度的上限和 PathBuffer 保持一致 */
+    float RR   = random_float_get();
+    float P_RR = path.depth + 1 >= PathBuffer::CAPACITY
+                         ? 0.f
+                         : integrator.termination.survival_probability(path.depth + 1, path.throughput);
+    if (RR >= P_RR)
+    {
+        path.alive = false;
+        return;
+    }
+
+    /* 根据材质的 BSDF 采样，生成下一次弹射的延伸光线 */
+    auto [wi_obj, pdf_obj, fr] = inter.mat()->sample(-path.ray.direction(), inter.normal());
+    float cos_theta            = inter.normal().get().dot(wi_obj.get());
+    if (pdf_obj <= 0.f || cos_theta <= 0.f)
+    {
+        /* 和 trace_path 相同：这个方向没有贡献，终止光路，避免 throughput 变为 Inf/NaN */
+        path.alive = false;
+        return;
+    }
+    path.throughput        = path.throughput.cwiseProduct(fr * cos_theta / pdf_obj / P_RR);
+    path.ray               = Ray{inter.pos() + inter.normal().get() * OFFSET, wi_obj};
+    path.depth += 1;
+}
+
+
+void RTRender::wavefront_intersect_primary(std::vector<WavefrontPath> &paths, unsigned thread_cnt)
+{
+    size_t packet_cnt = (paths.size() + RAY_PACKET_WIDTH - 1) / RAY_PACKET_WIDTH;
+    parallel_for(packet_cnt, thread_cnt, 256 / RAY_PACKET_WIDTH, [&](size_t packet_idx) {
+        size_t begin = packet_idx * RAY_PACKET_WIDTH;
+        int lane_cnt = (int) std::min((size_t) RAY_PACKET_WIDTH, paths.size() - begin);
+
+        RayPacket<RAY_PACKET_WIDTH> packet;
+        for (int lane = 0; lane < lane_cnt; ++lane)
+            packet.set(lane, paths[begin + lane].ray);
+
+        PacketHit<RAY_PACKET_WIDTH> hit;
+        _scene->intersect(packet, hit);
+        for (int lane = 0; lane < lane_cnt; ++lane)
+            paths[begin + lane].inter = hit.inter[lane];
+    });
+}
+
+
+/**
+ * 使用 wavefront 的方式渲染
+ *  \_ 将 (像素, 采样) 分成若干批，每一批生成摄像机光线
+ *  \_ 每次弹射：延伸光线求交 -> 着色 -> shadow ray 求交 -> 压缩，丢弃已经终止的光路
+ *  \_ 求交之前按照方向和原点对光线排序，让相邻的光线访问相近的 BVH 节点
+ *  \_ 第一次弹射是摄像机光线，使用光线包求交
+ *  \_ 终止的光路先写入这一批中自己的位置，一批结束后按照采样的顺序累加到像素
+ */
+void RTRender::render_wavefront(int batch_size)
+{
+    assert(batch_size > 0);
+    unsigned int thread_cnt = std::thread::hardware_concurrency();
+    const size_t chunk      = 256; /* 每个线程一次领取多少根光线 */
+
+    std::vector<RenderPixelTask> task_list = _prepare_render_task(_scene);
+    const BoundingBox &bounds              = _scene->bounding_box();
+    size_t sample_cnt                      = task_list.size() * _spp;
+
+    /* 每个像素累积的 radiance */
+    std::vector<Eigen::Vector3f> accum(task_list.size(), Eigen::Vector3f(0.f, 0.f, 0.f));
+
+    std::vector<WavefrontPath> paths, next_paths;
+    std::vector<WavefrontShadowRay> shadow_slots, shadow_queue;
+    std::vector<Eigen::Vector3f> batch_radiance;
+    paths.reserve(batch_size);
+    next_paths.reserve(batch_size);
+
+    fmt::print("\n");
+    for (size_t batch_begin = 0; batch_begin < sample_cnt; batch_begin += batch_size)
+    {
+        /**
+         * 生成这一批的摄像机光线：先遍历像素，再遍历采样
+         * 这样相邻的光线属于相邻的像素，天然是连贯的，适合组成光线包
+         */
+        size_t batch_end = std::min(batch_begin + (size_t) batch_size, sample_cnt);
+        paths.clear();
+        for (size_t sample = batch_begin; sample < batch_end; ++sample)
+        {
+            int pixel = (int) (sample % task_list.size());
+            auto seed = sample_seed_get(task_list[pixel].row * _scene->screen_width() + task_list[pixel].col,
+                                        (uint32_t) (sample / task_list.size()), _render_id);
+            paths.push_back(WavefrontPath{pixel, (int) (sample - batch_begin), task_list[pixel].ray, Pcg32(seed)});
+        }
+        batch_radiance.assign(paths.size(), Eigen::Vector3f(0.f, 0.f, 0.f));
+
+        for (bool primary = true; !paths.empty(); primary = false)
+        {
+            /* 1. 延伸光线与场景求交 */
+            if (primary)
+                wavefront_intersect_primary(paths, thread_cnt);
+            else
+                parallel_for(paths.size(), thread_cnt, chunk,
+                             [&](size_t i) { paths[i].inter = _scene->intersect(paths[i].ray); });
+
+            /* 2. 着色：生成 shadow ray 和下一次弹射的延伸光线 */
+            shadow_slots.assign(paths.size(), WavefrontShadowRay{});
+            parallel_for(paths.size(), thread_cnt, chunk, [&](size_t i) {
+                shadow_slots[i].path_idx = (int) i;
+                std::swap(random_engine(), paths[i].rng);
+                wavefront_shade(paths[i], shadow_slots[i]);
+                std::swap(random_engine(), paths[i].rng);
+            });
+
+            /* 3. shadow ray 入队，排序后判断是否被遮挡 */
+            shadow_queue.clear();
+            for (auto &shadow : shadow_slots)
+                if (shadow.valid)
+                    shadow_queue.push_back(shadow);
+            sort_coherent(shadow_queue, bounds, [](const auto &shadow) { return Ray{shadow.origin, shadow.direction}; });
+            parallel_for(shadow_queue.size(), thread_cnt, chunk, [&](size_t i) {
+                auto &shadow   = shadow_queue[i];
+                shadow.visible = !_scene->occluded(Ray{shadow.origin, shadow.direction}, shadow.t_max);
+            });
+            for (auto &shadow : shadow_queue)
+                if (shadow.visible)
+                    paths[shadow.path_idx].radiance += shadow.contribution;
+
+            /* 4. 压缩：终止的光路写入自己的位置，存活的光路排序后进入下一次弹射 */
+            next_paths.clear();
+            for (auto &path : paths)
+            {
+                if (path.alive)
+                    next_paths.push_back(std::move(path));
+                else
+                    batch_radiance[path.slot] = path.radiance;
+            }
+            sort_coherent(next_paths, bounds, [](const auto &path) { return path.ray; });
+            paths.swap(next_paths);
+        }
+
+        /* 按照采样的顺序累加到像素，结果和批的大小、光路的排序无关 */
+        for (size_t i = 0; i < batch_radiance.size(); ++i)
+            accum[(batch_begin + i) % task_list.size()] += batch_radiance[i];
+
+        /* 更新进度 */
+        fmt::print("\rsamples: {}/{}", batch_end, sample_cnt);
+        fflush(stdout);
+    }
+    fmt::print("\n");
+
+    /* 将结果写入 framebuffer */
+    for (size_t i = 0; i < task_list.size(); ++i)
+    {
+        int idx              = task_list[i].row * _scene->screen_width() + task_list[i].col;
+        radiance_buffer[idx] = accum[i] / _spp;
+        framebuffer[idx]     = gamma_correct(radiance_buffer[idx]);
+    }
+}
+
+
+/**
+ * 渐进式渲染
+ *  \_ 每一轮：所有线程通过原子计数器领取像素，每个像素追踪 pass_spp 根光线，累积到 film 中
+ *  \_ 每一轮结束：更新 framebuffer，检查时间预算和噪声目标
+ */
+int RTRender::render_progressive(int time_budget_ms, float target_noise, int pass_spp,
+                                 const std::function<void(int)> &on_pass)
+{
+    assert(time_budget_ms > 0 && pass_spp > 0);
+    unsigned int thread_cnt = std::thread::hardware_concurrency();
+
+    std::vector<RenderPixelTask> task_list = _prepare_render_task(_scene);
+    film = Film(_scene->screen_width(), _scene->screen_height());
+    _build_gbuffer(task_list, thread_cnt);
+
+    auto start = std::chrono::steady_clock::now();
+    int spp    = 0;
+    fmt::print("\n");
+    while (true)
+    {
+        parallel_for(task_list.size(), thread_cnt, 64, [&](size_t i) {
+            thread_local PathBuffer buffer;
+            Film::Pixel &pixel = film.at(task_list[i].row, task_list[i].col);
+            for (int s = 0; s < pass_spp; ++s)
+            {
+                auto [ray, primary] = _primary_get(task_list[i].col, task_list[i].row, pixel.spp);
+                _sample_seed_set(task_list[i].col, task_list[i].row, pixel.spp);
+                pixel.add(trace_path<NoCapture>(ray, primary, buffer));
+            }
+        });
+        spp += pass_spp;
+
+        /* 每一轮都更新 framebuffer */
+        drawFrameBuffer(film);
+        if (on_pass)
+            on_pass(spp);
+
+        /* 检查是否达到了时间预算或者噪声目标 */
+        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        float noise = film.max_std_error();
+        fmt::print("\rspp: {}, time: {}ms, noise: {:.4f}", spp, elapsed_ms, noise);
+        fflush(stdout);
+        if (elapsed_ms >= time_budget_ms || (target_noise > 0.f && noise <= target_noise))
+            break;
+    }
+    fmt::print("\n");
+
+    return spp;
+}
+
+
+void RTRender::train_guiding(int iterations, const PathGuiding::Options &options)
+{
+    assert(_scene && iterations > 0);
+    unsigned int thread_cnt = std::thread::hardware_concurrency();
+
+    std::vector<RenderPixelTask> task_list = _prepare_render_task(_scene);
+    guiding                 = std::make_shared<PathGuiding>(_scene->bounding_box(), options);
+    integrator.path_guiding = true;
+    _guiding_record         = true;
+
+    /* 训练用的采样和渲染的采样使用不同的随机数种子 */
+    const uint32_t train_id = ~_render_id;
+    int trained_spp = 0;
+    for (int iter = 0; iter < iterations; ++iter)
+    {
+        const int pass_spp = 1 << iter;
+        parallel_for(task_list.size(), thread_cnt, 64, [&](size_t i) {
+            thread_local PathBuffer buffer;
+            const RenderPixelTask &task = task_list[i];
+            for (int s = 0; s < pass_spp; ++s)
+            {
+                auto [ray, primary] = _primary_get(task.col, task.row, trained_spp + s);
+                random_seed_set(sample_seed_get(task.row * _scene->screen_width() + task.col, trained_spp + s,
+                                                train_id));
+                trace_path<NoCapture>(ray, primary, buffer);
+            }
+        });
+        trained_spp += pass_spp;
+        guiding->refine();
+        fmt::print("path guiding: iteration {}, spp: {}, spatial leaves: {}\n", iter, pass_spp, guiding->leaf_cnt());
+    }
+    _guiding_record = false;
+}
+
+
+std::vector<std::shared_ptr<RTRender::RenderPixelResult>> RTRender::render_to_memory(unsigned thread_cnt)
+{
+    std::vector<RenderPixelTask> task_list = _prepare_render_task(_scene);
+    _build_gbuffer(task_list, thread_cnt);
+
+    std::vector<std::shared_ptr<RenderPixelResult>> results(task_list.size());
+    parallel_for(task_list.size(), thread_cnt, 16, [&](size_t i) {
+        results[i] = jobRenderOnePixel<FullPath>(task_list[i]);
+        drawFrameBuffer(results[i]);
+    });
+    return results;
+}
+
+
+void RTRender::reshade_path(std::deque<PathNode> &path)
+{
+    for (int i = (int) path.size() - 1; i >= 0; --i)
+    {
+        PathNode &node = path[i];
+
+        /* 摄像机光线没有交点，或者直接看到了光源 */
+        if (!node.inter.happened() || node.inter.mat()->is_emission())
+        {
+            node.Lo = node.inter.happened() ? node.inter.mat()->emission() : Eigen::Vector3f(0.f, 0.f, 0.f);
+            continue;
+        }
+        const Direction &N = node.inter.normal();
+        const Material &mat = *node.inter.mat();
+
+        /* 来自光源：光源可见时更新 Le */
+        auto &light = node.from_light;
+        if (light.weight > 0.f || !light.Li_light.isZero())
+            light.Li_light = light.inter_light.mat()->emission();
+        Eigen::Vector3f Lo = light.Li_light.cwiseProduct(mat.brdf_phong(light.wi_light, node.wo, N)) * light.weight;
+
+        /* 来自物体：下一个节点的 Lo，或者击中的光源 */
+        auto &obj = node.from_obj;
+        if (i + 1 < (int) path.size())
+            obj.Li_obj = path[i + 1].Lo;
+        else if (obj.inter_obj.happened() && obj.inter_obj.mat()->is_emission())
+            obj.Li_obj = obj.inter_obj.mat()->emission() * obj.mis;
+        Lo += obj.Li_obj.cwiseProduct(mat.brdf_phong(obj.wi_obj, node.wo, N)) * obj.weight;
+
+        node.Lo = Lo;
+    }
+}
+
+
+void RTRender::reshade(const std::vector<std::shared_ptr<RenderPixelResult>> &results, unsigned thread_cnt)
+{
+    parallel_for(results.size(), thread_cnt, 16, [&](size_t i) {
+        RenderPixelResult &res = *results[i];
+        res.radiance = Eigen::Vector3f(0.f, 0.f, 0.f);
+        for (auto &path : res.path_list)
+        {
+            reshade_path(path);
+            res.radiance += path.front().Lo;
+        }
+        if (!res.path_list.empty())
+            res.radiance /= (float) res.path_list.size();
+        drawFrameBuffer(results[i]);
+    });
+}
+
+
+void RTRender::vpl_build(const InstantRadiosity::Options &options)
+{
+    assert(_scene);
+    integrator.type = IntegratorType::InstantRadiosity;
+    integrator.vpl  = options;
+    vpls            = InstantRadiosity::generate(*_scene, options, OFFSET, _render_id);
+}
+
+
+void RTRender::cache_enable(const RadianceCache::Options &options)
+{
+    assert(_scene);
+    cache = std::make_shared<RadianceCache>(_scene->bounding_box(), options);
+    integrator.radiance_cache = true;
+}
+
+
+/**
+ * 自适应采样
+ *  \_ 每一轮：master 将需要采样的像素放入任务列表，worker 追踪光线并累积到 film 中
+ *      （一个像素在一轮中只有一个任务，所以 worker 之间不会同时写同一个像素）
+ *  \_ 一轮的所有结果都返回后，根据 film 中的误差统计，选出下一轮需要继续采样的像素
+ */
+size_t RTRender::render_adaptive(int base_spp, int max_spp, float threshold, int pass_spp, int worker_cnt)
+{
+    assert(base_spp > 0 && max_spp >= base_spp && pass_spp > 0);
+
+    /* 给一个像素增加若干个采样的任务 */
+    struct AdaptiveTask {
+        RenderPixelTask pixel;
+        int spp;
+    };
+
+    std::vector<RenderPixelTask> pixel_tasks = _prepare_render_task(_scene);
+    film = Film(_scene->screen_width(), _scene->screen_height());
+    _build_gbuffer(pixel_tasks, worker_cnt);
+
+    /* 任务列表和结果列表，结果是完成的采样数 */
+    std::mutex task_mtx, res_mtx;
+    std::vector<AdaptiveTask> task_list;
+    std::vector<int> res_list;
+    auto job = [this](const AdaptiveTask &task) {
+        thread_local PathBuffer buffer;
+        Film::Pixel &pixel = film.at(task.pixel.row, task.pixel.col);
+        for (int i = 0; i < task.spp; ++i)
+        {
+            auto [ray, primary] = _primary_get(task.pixel.col, task.pixel.row, pixel.spp);
+            _sample_seed_set(task.pixel.col, task.pixel.row, pixel.spp);
+            pixel.add(trace_path<NoCapture>(ray, primary, buffer));
+        }
+        return task.spp;
+    };
+    std::vector<Worker<AdaptiveTask, int>> workers(
+            worker_cnt, Worker<AdaptiveTask, int>(task_list, task_mtx, res_list, res_mtx, job, 16, 1));
+    for (auto &worker : workers)
+        worker.start();
+
+    /* 第一轮：所有像素都有 base_spp 个采样 */
+    std::vector<AdaptiveTask> round_tasks;
+    for (auto &pixel_task : pixel_tasks)
+        round_tasks.push_back({pixel_task, base_spp});
+
+    size_t sample_cnt = 0;
+    fmt::print("\n");
+    for (int round = 0; !round_tasks.empty(); ++round)
+    {
+        size_t round_task_cnt = round_tasks.size();
+        {
+            std::lock_guard<std::mutex> lck(task_mtx);
+            task_list.insert(task_list.end(), round_tasks.begin(), round_tasks.end());
+        }
+
+        /* 等待这一轮的所有结果 */
+        size_t processed_cnt = 0;
+        while (processed_cnt < round_task_cnt)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            std::lock_guard<std::mutex> lck(res_mtx);
+            processed_cnt += res_list.size();
+            for (int spp : res_list)
+                sample_cnt += spp;
+            res_list.clear();
+        }
+
+        /* 误差仍然大于阈值的像素，进入下一轮 */
+        round_tasks.clear();
+        for (auto &pixel_task : pixel_tasks)
+        {
+            const Film::Pixel &pixel = film.at(pixel_task.row, pixel_task.col);
+            if (pixel.spp < max_spp && pixel.relative_error() > threshold)
+                round_tasks.push_back({pixel_task, std::min(pass_spp, max_spp - pixel.spp)});
+        }
+
+        drawFrameBuffer(film);
+        fmt::print("\rround: {}, samples: {}, pixels to refine: {}", round, sample_cnt, round_tasks.size());
+        fflush(stdout);
+    }
+    fmt::print("\n");
+
+    for (auto &worker : workers)
+        worker.stop();
+    return sample_cnt;
 }
 
 
-void RTRender::render_single_thread(const std::string &db_path)
+/**
+ * 可以中断和继续的渲染
+ *  \_ 区块通过原子计数器领取，区块内的像素先复制到局部的缓冲中，补齐到 spp 个采样之后，加锁写回 film
+ *  \_ 主线程定期加锁保存 film，保存的总是完整的像素，没有写回的区块下次从头开始
+ *  \_ 每个像素的采样数就是调度的状态，不需要记录哪些区块已经完成
+ */
+size_t RTRender::render_resumable(const std::string &checkpoint_path, int checkpoint_interval_ms, int tile_size,
+                                  TileOrder tile_order)
+{
+    assert(_scene && checkpoint_interval_ms > 0);
+    unsigned int thread_cnt = ThreadPool::shared().size();
+
+    bool resumed = !checkpoint_path.empty() && checkpoint_load(checkpoint_path);
+    if (!resumed && (film.width() != _scene->screen_width() || film.height() != _scene->screen_height()))
+        film = Film(_scene->screen_width(), _scene->screen_height());
+
+    std::vector<RenderTile> tile_list = _prepare_render_tiles(_scene, tile_size, tile_order);
+    _build_gbuffer(_prepare_render_task(_scene), thread_cnt);
+
+    std::mutex film_mtx;
+    std::atomic<size_t> next_tile{0}, tile_ok_cnt{0}, sample_cnt{0};
+    auto thread_func = [&]() {
+        thread_local PathBuffer buffer;
+        std::vector<Film::Pixel> pixels;
+        while (true)
+        {
+            size_t tile_idx = next_tile.fetch_add(1, std::memory_order_relaxed);
+            if (tile_idx >= tile_list.size())
+                break;
+
+            // 只有这个线程会写这些像素，读取时不需要加锁
+            const RenderTile &tile = tile_list[tile_idx];
+            pixels.clear();
+            for (auto &task : tile.tasks)
+                pixels.push_back(film.at(task.row, task.col));
+
+            size_t tile_samples = 0;
+            for (size_t i = 0; i < tile.tasks.size(); ++i)
+            {
+                const RenderPixelTask &task = tile.tasks[i];
+                Film::Pixel &pixel          = pixels[i];
+                while (pixel.spp < _spp)
+                {
+                    auto [ray, primary] = _primary_get(task.col, task.row, pixel.spp);
+                    _sample_seed_set(task.col, task.row, pixel.spp);
+                    pixel.add(trace_path<NoCapture>(ray, primary, buffer));
+                    ++tile_samples;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lck(film_mtx);
+                for (size_t i = 0; i < tile.tasks.size(); ++i)
+                    film.at(tile.tasks[i].row, tile.tasks[i].col) = pixels[i];
+            }
+            sample_cnt += tile_samples;
+            ++tile_ok_cnt;
+        }
+    };
+
+    std::vector<std::future<void>> futures;
+    for (unsigned i = 0; i < thread_cnt; ++i)
+        futures.push_back(ThreadPool::shared().submit(thread_func));
+
+    // 等待所有区块完成，期间定期保存进度
+    fmt::print("\n");
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    for (auto &future : futures)
+    {
+        while (future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (checkpoint_path.empty() ||
+                std::chrono::duration_cast<std::chrono::milliseconds>(now - last_checkpoint).count() <
+                checkpoint_interval_ms)
+                continue;
+            {
+                std::lock_guard<std::mutex> lck(film_mtx);
+                checkpoint_save(checkpoint_path);
+            }
+            last_checkpoint = now;
+            fmt::print("\rtiles: {}/{}, samples: {}, checkpoint saved", tile_ok_cnt.load(), tile_list.size(),
+                       sample_cnt.load());
+            fflush(stdout);
+        }
+    }
+    fmt::print("\rtiles: {}/{}, samples: {}\n", tile_ok_cnt.load(), tile_list.size(), sample_cnt.load());
+
+    if (!checkpoint_path.empty())
+        checkpoint_save(checkpoint_path);
+    drawFrameBuffer(film);
+    return sample_cnt;
+}
+
+
+size_t RTRender::render_more(const std::string &checkpoint_path, int extra_spp, int checkpoint_interval_ms)
+{
+    assert(extra_spp > 0);
+    if (!checkpoint_load(checkpoint_path))
+        throw std::runtime_error(fmt::format("checkpoint not found: {}", checkpoint_path));
+
+    int max_spp = 0;
+    for (auto &pixel : film.pixels())
+        max_spp = std::max(max_spp, pixel.spp);
+    _spp = max_spp + extra_spp;
+
+    // 进度中的 spp 已经更新，render_resumable 恢复的就是新的目标
+    checkpoint_save(checkpoint_path);
+    return render_resumable(checkpoint_path, checkpoint_interval_ms);
+}
+
+
+/* 进度文件的格式：魔数、版本、render_id、spp，之后是 Film::write 写入的内容 */
+static const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+
+void RTRender::checkpoint_save(const std::string &path) const
+{
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error(fmt::format("fail to open checkpoint: {}", tmp_path));
+        os.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        os.write(reinterpret_cast<const char *>(&CHECKPOINT_VERSION), sizeof(CHECKPOINT_VERSION));
+        os.write(reinterpret_cast<const char *>(&_render_id), sizeof(_render_id));
+        os.write(reinterpret_cast<const char *>(&_spp), sizeof(_spp));
+        film.write(os);
+        if (!os.flush())
+            throw std::runtime_error(fmt::format("fail to write checkpoint: {}", tmp_path));
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw std::runtime_error(fmt::format("fail to rename checkpoint: {} -> {}", tmp_path, path));
+}
+
+
+bool RTRender::checkpoint_load(const std::string &path)
+{
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+        return false;
+
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    uint32_t version = 0, render_id = 0;
+    int spp = 0;
+    is.read(magic, sizeof(magic));
+    is.read(reinterpret_cast<char *>(&version), sizeof(version));
+    is.read(reinterpret_cast<char *>(&render_id), sizeof(render_id));
+    is.read(reinterpret_cast<char *>(&spp), sizeof(spp));
+    if (!is || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || version != CHECKPOINT_VERSION)
+        throw std::runtime_error(fmt::format("invalid checkpoint: {}", path));
+    if (render_id != _render_id)
+        throw std::runtime_error(fmt::format("checkpoint render id mismatch: {} != {}", render_id, _render_id));
+
+    Film loaded;
+    loaded.read(is);
+    if (loaded.width() != _scene->screen_width() || loaded.height() != _scene->screen_height())
+        throw std::runtime_error(fmt::format("checkpoint size mismatch: {}x{}", loaded.width(), loaded.height()));
+
+    film = std::move(loaded);
+    _spp = spp;
+    return true;
+}
+
+
+std::vector<RTRender::PixelType> RTRender::sample_count_map(const Film &film)
+{
+    int max_spp = 1;
+    for (auto &pixel : film.pixels())
+        max_spp = std::max(max_spp, pixel.spp);
+
+    std::vector<PixelType> res;
+    res.reserve(film.pixels().size());
+    for (auto &pixel : film.pixels())
+    {
+        auto gray = (unsigned char) (255 * pixel.spp / max_spp);
+        res.push_back({gray, gray, gray});
+    }
+    return res;
+}
+
+
+void RTRender::render_single_thread(const std::string &db_path, CaptureMode capture)
 {
     std::vector<RenderPixelTask> render_tasks = _prepare_render_task(_scene);
+    bool use_db                               = capture != CaptureMode::None;
+    PixelJob job                              = pixel_job(capture);
+    _build_gbuffer(render_tasks, 1);
 
     /* 连接到数据库，并清空数据 */
-    DB::init_db(db_path);
-    sqlite3_exec(DB::db, "DELETE FROM node", nullptr, nullptr, nullptr);
-    sqlite3_exec(DB::db, "DELETE FROM path", nullptr, nullptr, nullptr);
+    if (use_db)
+    {
+        _db_open(db_path);
+    }
 
     fmt::print("tasks: (0 / 0)");
     for (int i = 0; i < render_tasks.size(); ++i)
     {
         /* 计算一个像素的光路信息 */
-        auto res = jobRenderOnePixel(render_tasks[i]);
+        auto res = (this->*job)(render_tasks[i]);
 
         /* 处理光路信息 */
         drawFrameBuffer(res);
 
         /* 将光路信息写入数据库 */
-        insert_pixel_ray(DB::db, *res);
+        if (use_db)
+            insert_pixel_ray(_db, *res);
 
         /* 更新进度 */
         fmt::print("\rtasks: ({} / {})", i, render_tasks.size());
     }
 
-    DB::close_db();
+    if (use_db)
+        _db_close();
 }
 
+template<class CaptureT_>
 std::shared_ptr<RTRender::RenderPixelResult> RTRender::jobRenderOnePixel(const RTRender::RenderPixelTask &task)
 {
-    std::vector<std::deque<PathNode>> path_list;
-    path_list.reserve(_spp);
+    /* 每个线程持有一个路径缓存，所有的采样都复用它 */
+    thread_local PathBuffer buffer;
+
+    std::shared_ptr<RenderPixelResult> res(new RenderPixelResult{task.col, task.row});
+    if constexpr (CaptureT_::RECORD_RADIANCE)
+        res->path_list.reserve(_spp);
     for (int i = 0; i < _spp; ++i)
     {
-        path_list.push_back(cast_ray(task.ray));
+        auto [ray, primary] = _primary_get(task.col, task.row, i);
+        _sample_seed_set(task.col, task.row, i);
+        Eigen::Vector3f radiance = trace_path<CaptureT_>(ray, primary, buffer);
+        res->radiance += radiance / _spp;
+
+        if constexpr (CaptureT_::RECORD_PATH)
+        {
+            res->path_list.emplace_back(buffer.begin(), buffer.end());
+        }
+        else if constexpr (CaptureT_::RECORD_RADIANCE)
+        {
+            /* 只记录一个节点：摄像机看到的 radiance */
+            PathNode node;
+            node.Lo      = radiance;
+            node.wo      = -ray.direction();
+            node.pos_out = ray.origin();
+            res->path_list.push_back({node});
+        }
     }
-    return std::shared_ptr<RenderPixelResult>(new RenderPixelResult{task.col, task.row, std::move(path_list)});
+    return res;
 }
 
-void RTRender::drawFrameBuffer(const std::shared_ptr<RenderPixelResult> &res)
+std::shared_ptr<RTRender::RenderPixelResult> RTRender::jobRenderOutliers(const RenderPixelTask &task)
 {
-    assert(res->path_list.size() == _spp);
+    thread_local PathBuffer buffer;
+    thread_local std::vector<float> lum;
 
-    /* 得到最终的 radiance */
-    Eigen::Vector3f radiance{0.f, 0.f, 0.f};
-    for (auto &path: res->path_list)
+    std::shared_ptr<RenderPixelResult> res(new RenderPixelResult{task.col, task.row});
+    PixelStat &stat = res->stat;
+    stat.spp        = _spp;
+    lum.assign(_spp, 0.f);
+
+    /* 第一遍：只计算 radiance，使用 Welford 算法在线统计有限采样的亮度 */
+    int n       = 0;
+    double mean = 0.0, m2 = 0.0;
+    for (int i = 0; i < _spp; ++i)
     {
-        radiance += path[0].Lo / _spp;
+        auto [ray, primary] = _primary_get(task.col, task.row, i);
+        _sample_seed_set(task.col, task.row, i);
+        Eigen::Vector3f radiance = trace_path<NoCapture>(ray, primary, buffer);
+        res->radiance += radiance / _spp;
+
+        if (!radiance.allFinite())
+        {
+            lum[i] = std::numeric_limits<float>::quiet_NaN();
+            ++stat.nonfinite_cnt;
+            continue;
+        }
+        lum[i]       = luminance(radiance);
+        double delta = lum[i] - mean;
+        mean += delta / ++n;
+        m2 += delta * (lum[i] - mean);
     }
+    stat.lum_mean = (float) mean;
+    stat.lum_std  = n > 1 ? (float) std::sqrt(m2 / (n - 1)) : 0.f;
 
+    /* 第二遍：和其他采样比较，也就是去掉这个采样之后的均值和标准差 */
+    for (int i = 0; i < _spp; ++i)
+    {
+        bool outlier = !std::isfinite(lum[i]);
+        if (!outlier && n >= std::max(3, outlier_criteria.min_spp))
+        {
+            double x         = lum[i];
+            double mean_o    = (mean * n - x) / (n - 1);
+            double m2_o      = std::max(0.0, m2 - (x - mean) * (x - mean_o));
+            double std_o     = std::sqrt(m2_o / (n - 2));
+            double deviation = std::abs(x - mean_o);
+            outlier = deviation > outlier_criteria.k_sigma * std_o && deviation > outlier_criteria.min_deviation;
+        }
+        if (!outlier)
+            continue;
+
+        /* 随机数种子只由采样序号决定，重新追踪得到相同的光路 */
+        stat.outliers.push_back(i);
+        auto [ray, primary] = _primary_get(task.col, task.row, i);
+        _sample_seed_set(task.col, task.row, i);
+        trace_path<FullPath>(ray, primary, buffer);
+        res->path_list.emplace_back(buffer.begin(), buffer.end());
+    }
+    return res;
+}
+
+
+void RTRender::_db_open(const std::string &db_path)
+{
+    _db = DB::open_db(db_path);
+    sqlite3_exec(_db, "DELETE FROM node", nullptr, nullptr, nullptr);
+    sqlite3_exec(_db, "DELETE FROM path", nullptr, nullptr, nullptr);
+    PixelStatSerialize::createTable(_db);
+    PixelStatSerialize::deleteTable(_db);
+}
+
+
+RTRender::PixelJob RTRender::pixel_job(CaptureMode capture)
+{
+    switch (capture)
+    {
+        case CaptureMode::None: return &RTRender::jobRenderOnePixel<NoCapture>;
+        case CaptureMode::RadianceOnly: return &RTRender::jobRenderOnePixel<RadianceOnly>;
+        case CaptureMode::FullPath: return &RTRender::jobRenderOnePixel<FullPath>;
+        case CaptureMode::Outliers: return &RTRender::jobRenderOutliers;
+        default: throw std::runtime_error("never");
+    }
+}
+
+RTRender::RenderTileResult RTRender::jobRenderOneTile(const RTRender::RenderTile &tile, PixelJob pixel_job)
+{
+    RenderTileResult result;
+    result.reserve(tile.tasks.size());
+    for (auto &task : tile.tasks)
+        result.push_back((this->*pixel_job)(task));
+    return result;
+}
+
+void RTRender::drawFrameBuffer(const std::shared_ptr<RenderPixelResult> &res)
+{
     /* 将结果写入 framebuffer */
-    framebuffer[res->row * _scene->screen_width() + res->col] = gamma_correct(radiance);
+    int idx              = res->row * _scene->screen_width() + res->col;
+    radiance_buffer[idx] = res->radiance;
+    framebuffer[idx]     = gamma_correct(res->radiance);
+}
+
+void RTRender::drawFrameBuffer(const Film &film)
+{
+    for (int row = 0; row < film.height(); ++row)
+        for (int col = 0; col < film.width(); ++col)
+        {
+            int idx              = row * _scene->screen_width() + col;
+            radiance_buffer[idx] = film.at(row, col).radiance();
+            framebuffer[idx]     = gamma_correct(radiance_buffer[idx]);
+        }
 }
+
+
+AOVBuffer RTRender::aov_get(unsigned thread_cnt)
+{
+    int width      = _scene->screen_width();
+    int height     = _scene->screen_height();
+    int offset_cnt = gbuffer.empty() ? 1 : gbuffer.offset_cnt();
+    AOVBuffer aov(width, height);
+
+    parallel_for((size_t) width * height, thread_cnt, 64, [&](size_t i) {
+        int row = (int) i / width;
+        int col = (int) i % width;
+        for (int k = 0; k < offset_cnt; ++k)
+        {
+            auto [ray, inter] = _primary_get(col, row, k);
+            if (!inter.happened())
+                continue;
+            aov.albedo[i] += inter.mat()->albedo() / (float) offset_cnt;
+            aov.normal[i] += inter.normal().get() / (float) offset_cnt;
+            aov.depth[i] += inter.t_near() / (float) offset_cnt;
+        }
+    });
+    return aov;
+}
+
+
+void RTRender::denoise(const Denoiser::Options &options)
+{
+    unsigned int thread_cnt = std::thread::hardware_concurrency();
+    AOVBuffer aov           = aov_get(thread_cnt);
+
+    std::vector<Eigen::Vector3f> denoised = Denoiser::atrous(radiance_buffer, aov, options, thread_cnt);
+    for (size_t i = 0; i < denoised.size(); ++i)
+        framebuffer[i] = gamma_correct(denoised[i]);
+}
+
+
+/* 测试和其他模块会直接调用积分器，显式地实例化所有的记录策略 */
+template Eigen::Vector3f RTRender::trace_path<NoCapture>(const Ray &, const Intersection &, PathBuffer &);
+template Eigen::Vector3f RTRender::trace_path<RadianceOnly>(const Ray &, const Intersection &, PathBuffer &);
+template Eigen::Vector3f RTRender::trace_path<FullPath>(const Ray &, const Intersection &, PathBuffer &);
@@ -20,6 +20,7 @@ std::tuple<float, Intersection> Scene::sample_light() const {
         if (temp_total_area > area_threshold - epsilon_3) {
             emit_obj = obj;
             area_threshold_obj = area_threshold - (temp_total_area - obj->area());
+            break;
         }
     }
 
@@ -34,8 +35,9 @@ std::tuple<float, Intersection> Scene::sample_light() const {
     }
 
     // 如果找到了：去物体内部采样
+    // 选中物体的概率和面积成正比，所以采样点的 pdf 是所有光源总面积的倒数
     return {
-            1.f / emit_obj->area(),
+            1.f / _emit.total_area,
             emit_obj->obj_sample(area_threshold_obj)
             // Object::sample_obj(emit_obj, area_threshold_obj)
     };
@@ -53,6 +55,17 @@ void Scene::obj_add(const std::shared_ptr<Object> &obj) {
 }
 
 
+std::shared_ptr<Scene> Scene::view(int screen_width, int screen_height, float fov,
+                                   const Eigen::Vector3f &camera_look_at,
+                                   const Eigen::Vector3f &camera_pos) const {
+    auto res = std::make_shared<Scene>(screen_width, screen_height, fov, camera_look_at, camera_pos);
+    res->_objs = this->_objs;
+    res->_bvh = this->_bvh;
+    res->_emit = this->_emit;
+    return res;
+}
+
+
 void Scene::initInverseViewMatrix() {
     // 防止死锁
     assert(std::abs(this->_camera.look_at.get().y()) < 0.9f);
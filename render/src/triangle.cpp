@@ -9,35 +9,97 @@
 /**
  * 使用 Moller Trumbore 算法来计算光线和三角形的交点
  *  b1 和 b2 表示三角形重心差值参数
- * @param ray
- * @return
+ * @param [out]t_near 发生相交时，光线原点到交点的距离
+ * @return 是否相交
  */
-Intersection Triangle::intersect(const Ray &ray) {
+bool Triangle::_hit(const Ray &ray, float &t_near) const {
     // Moller Trumbore 算法
-    auto E1 = this->B() - this->A();
-    auto E2 = this->C() - this->A();
-    auto S = ray.origin() - this->A();
-    auto S1 = ray.direction().get().cross(E2);
-    auto S2 = S.cross(E1);
+    // 注：A()、B() 等返回的是临时对象，不能用 auto 保存 Eigen 的表达式模板，否则开启优化后会引用已经销毁的对象
+    Eigen::Vector3f E1 = this->B() - this->A();
+    Eigen::Vector3f E2 = this->C() - this->A();
+    Eigen::Vector3f S = ray.origin() - this->A();
+    Eigen::Vector3f S1 = ray.direction().get().cross(E2);
+    Eigen::Vector3f S2 = S.cross(E1);
 
     float S1_dot_S2 = S1.dot(E1);
     if (std::abs(S1_dot_S2) <= std::numeric_limits<float>::epsilon())
-        return Intersection::no_intersect();
+        return false;
 
-    float t_near = S2.dot(E2) / S1_dot_S2;
+    t_near = S2.dot(E2) / S1_dot_S2;
     float b1 = S1.dot(S) / S1_dot_S2;
     float b2 = S2.dot(ray.direction().get()) / S1_dot_S2;
 
     // todo 在比较 t_near 时是否可以 epsilon，防止在自身弹射
-    if (t_near > 0.f && b1 >= 0.f && b2 >= 0.f &&
-        (1.f - b1 - b2) >= -std::numeric_limits<float>::min()) {
-        return Intersection(ray.origin() + t_near * ray.direction().get(),
-                            this->normal(),
-                            t_near,
-                            this->mat());
+    return t_near > 0.f && b1 >= 0.f && b2 >= 0.f &&
+           (1.f - b1 - b2) >= -std::numeric_limits<float>::min();
+}
+
+Intersection Triangle::intersect(const Ray &ray) {
+    float t_near;
+    if (!_hit(ray, t_near))
+        return Intersection::no_intersect();
+    return Intersection(ray.origin() + t_near * ray.direction().get(),
+                        this->normal(),
+                        t_near,
+                        this->mat(),
+                        this);
+}
+
+bool Triangle::occluded(const Ray &ray, float t_max) {
+    float t_near;
+    return _hit(ray, t_near) && t_near < t_max;
+}
+
+/**
+ * 光线包版本的 Moller Trumbore 算法，判断条件和单根光线的版本相同
+ * 三角形的数据广播到所有通道，每个通道计算一根光线
+ */
+template<int N_>
+void Triangle::_intersect_packet(const RayPacket<N_> &packet, uint32_t mask, PacketHit<N_> &hit) {
+    using F = PacketFloat<N_>;
+
+    PacketVec3<N_> E1 = PacketVec3<N_>::broadcast(_b - _a);
+    PacketVec3<N_> E2 = PacketVec3<N_>::broadcast(_c - _a);
+    PacketVec3<N_> D = packet.direction();
+    PacketVec3<N_> S = packet.origin() - PacketVec3<N_>::broadcast(_a);
+    PacketVec3<N_> S1 = D.cross(E2);
+    PacketVec3<N_> S2 = S.cross(E1);
+
+    F S1_dot_S2 = S1.dot(E1);
+    mask &= lanes_gt(packet_abs(S1_dot_S2), F::broadcast(std::numeric_limits<float>::epsilon()));
+    if (!mask) return;
+
+    F t_near = S2.dot(E2) / S1_dot_S2;
+    F b1 = S1.dot(S) / S1_dot_S2;
+    F b2 = S2.dot(D) / S1_dot_S2;
+    F zero = F::broadcast(0.f);
+
+    mask &= lanes_gt(t_near, zero) & lanes_ge(b1, zero) & lanes_ge(b2, zero) &
+            lanes_ge(F::broadcast(1.f) - b1 - b2, F::broadcast(-std::numeric_limits<float>::min())) &
+            lanes_lt(t_near, F::load(hit.t));
+    if (!mask) return;
+
+    // 只有发生相交的光线才需要构造 Intersection
+    alignas(32) float t[N_];
+    t_near.store(t);
+    for (int i = 0; i < N_; ++i) {
+        if (!(mask >> i & 1u)) continue;
+        Eigen::Vector3f dir(packet.dx[i], packet.dy[i], packet.dz[i]);
+        hit.t[i] = t[i];
+        hit.inter[i] = Intersection(Eigen::Vector3f(packet.ox[i], packet.oy[i], packet.oz[i]) + t[i] * dir,
+                                    this->normal(),
+                                    t[i],
+                                    this->mat(),
+                                    this);
     }
+}
+
+void Triangle::intersect_packet(const RayPacket<4> &packet, uint32_t mask, PacketHit<4> &hit) {
+    _intersect_packet(packet, mask, hit);
+}
 
-    return Intersection::no_intersect();
+void Triangle::intersect_packet(const RayPacket<8> &packet, uint32_t mask, PacketHit<8> &hit) {
+    _intersect_packet(packet, mask, hit);
 }
 
 Intersection Triangle::obj_sample(float area_threshold) {
@@ -48,11 +110,12 @@ Intersection Triangle::obj_sample(float area_threshold) {
     float y = random_float_get();
 
     auto inter_pos = this->_a * (1.f - x) + this->_b * (x * (1.f - y)) + this->_c * (x * y);
-    return Intersection(inter_pos, this->_normal, -1.f, this->mat());
+    return Intersection(inter_pos, this->_normal, -1.f, this->mat(), this);
 }
 
 
-std::vector<std::shared_ptr<MeshTriangle>> MeshTriangle::mesh_load(const std::string &file_path) {
+std::vector<std::shared_ptr<MeshTriangle>> MeshTriangle::mesh_load(const std::string &file_path,
+                                                                   BVHBuildMethod method) {
 
     SPDLOG_INFO("try to load scene from file: {}", file_path);
 
@@ -63,11 +126,11 @@ std::vector<std::shared_ptr<MeshTriangle>> MeshTriangle::mesh_load(const std::st
         return {};
     }
 
-    return process_ainode(*scene->mRootNode, *scene);
+    return process_ainode(*scene->mRootNode, *scene, method);
 }
 
 
-std::shared_ptr<MeshTriangle> MeshTriangle::process_aimesh(const aiMesh &mesh) {
+std::shared_ptr<MeshTriangle> MeshTriangle::process_aimesh(const aiMesh &mesh, BVHBuildMethod method) {
 
     std::vector<std::shared_ptr<Object>> objs(mesh.mNumFaces);
 
@@ -87,26 +150,27 @@ std::shared_ptr<MeshTriangle> MeshTriangle::process_aimesh(const aiMesh &mesh) {
     }
 
     // 构建 BVH
-    auto bvh_root = BVH::build(objs);
+    auto bvh_root = BVH::build(objs, method);
+    SPDLOG_INFO("mesh BVH SAH cost: {}", bvh_root->sah_cost());
 
     return std::make_shared<MeshTriangle>(mat, bvh_root);
 }
 
 
 std::vector<std::shared_ptr<MeshTriangle>>
-MeshTriangle::process_ainode(const aiNode &node, const aiScene &scene) {
+MeshTriangle::process_ainode(const aiNode &node, const aiScene &scene, BVHBuildMethod method) {
 
     std::vector<std::shared_ptr<MeshTriangle>> meshes;
 
     // 处理当前节点
     for (unsigned int i = 0; i < node.mNumMeshes; ++i) {
         unsigned int mesh_id = node.mMeshes[i];
-        meshes.push_back(process_aimesh(*scene.mMeshes[mesh_id]));
+        meshes.push_back(process_aimesh(*scene.mMeshes[mesh_id], method));
     }
 
     // 处理子节点
     for (unsigned int i = 0; i < node.mNumChildren; ++i) {
-        auto child_meshes = process_ainode(*node.mChildren[i], scene);
+        auto child_meshes = process_ainode(*node.mChildren[i], scene, method);
         meshes.insert(meshes.end(), child_meshes.begin(), child_meshes.end());
     }
 
@@ -0,0 +1,54 @@
+#include "vpl.h"
+
+#include <cassert>
+
+#include "utils.h"
+#include "material.h"
+
+
+std::vector<VPL> InstantRadiosity::generate(const Scene &scene, const Options &options, float offset,
+                                            uint32_t render_id)
+{
+    assert(options.light_paths > 0 && options.max_bounces >= 0);
+    std::vector<VPL> vpls;
+    vpls.reserve((size_t) options.light_paths * (options.max_bounces + 1));
+    const float inv_paths = 1.f / (float) options.light_paths;
+
+    for (int i = 0; i < options.light_paths; ++i)
+    {
+        /* 使用渲染中不会出现的采样序号，和摄像机光路的随机数错开 */
+        random_seed_set(sample_seed_get((uint32_t) i, UINT32_MAX, render_id));
+
+        auto [pdf_light, inter_light] = scene.sample_light();
+        if (!inter_light.happened() || pdf_light <= 0.f)
+            break;
+
+        /* 光源上的 VPL：发出的 radiance 是 Le，各个方向相同 */
+        Eigen::Vector3f Le = inter_light.mat()->emission();
+        vpls.push_back({inter_light.pos(), inter_light.normal(), Le / pdf_light * inv_paths});
+
+        /* 按照余弦加权离开光源：throughput = Le * cos / (pdf_light * cos / pi) */
+        Eigen::Vector3f throughput = Le * (float) M_PI / pdf_light * inv_paths;
+        auto [pdf_dir, wi] = Material::sample_himsphere_cosine(inter_light.normal());
+        Ray ray{inter_light.pos() + inter_light.normal().get() * offset, wi};
+
+        for (int bounce = 0; bounce < options.max_bounces; ++bounce)
+        {
+            Intersection inter = scene.intersect(ray);
+            if (!inter.happened() || inter.mat()->is_emission() || !inter.mat()->is_diffuse())
+                break;
+            if (inter.normal().get().dot(ray.direction().get()) >= 0.f)
+                break;      /* 击中了表面的背面 */
+
+            /* 漫反射的 BRDF 是 albedo / pi，和方向无关 */
+            Eigen::Vector3f albedo = inter.mat()->albedo();
+            vpls.push_back({inter.pos(), inter.normal(), throughput.cwiseProduct(albedo) / (float) M_PI});
+
+            /* 余弦加权采样：BRDF * cos / pdf = albedo */
+            throughput = throughput.cwiseProduct(albedo);
+            std::tie(pdf_dir, wi) = Material::sample_himsphere_cosine(inter.normal());
+            ray = Ray{inter.pos() + inter.normal().get() * offset, wi};
+        }
+    }
+    return vpls;
+}
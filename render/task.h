@@ -3,10 +3,15 @@
 
 #include <mutex>
 #include <deque>
+#include <atomic>
 #include <vector>
 #include <thread>
 #include <chrono>
 #include <memory>
+#include <future>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
 
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
@@ -132,4 +137,129 @@ void Worker<Task, Result>::_thread_func() {
 }
 
 
+/**
+ * 固定数量线程的线程池，任务按照提交的顺序执行
+ * 进程内的所有渲染共享同一个线程池 ThreadPool::shared()，同时进行的多个渲染不会创建超过 CPU 核心数的线程
+ * 任务不能阻塞地等待线程池中其他的任务，否则线程池被占满之后会死锁；parallel_for 的调用线程自己也会执行任务，不受此限制
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned thread_cnt) {
+        for (unsigned i = 0; i < std::max(1u, thread_cnt); ++i)
+            _threads.emplace_back(&ThreadPool::_thread_func, this);
+    }
+
+    /* 等待已经提交的任务执行完毕，之后终止所有的线程 */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lck(_mtx);
+            _should_stop = true;
+        }
+        _cv.notify_all();
+        for (auto &thread : _threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /* 提交一个任务，通过返回的 future 等待任务结束 */
+    std::future<void> submit(std::function<void()> func) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(func));
+        std::future<void> res = task->get_future();
+        {
+            std::lock_guard<std::mutex> lck(_mtx);
+            _tasks.emplace_back([task]() { (*task)(); });
+        }
+        _cv.notify_one();
+        return res;
+    }
+
+    [[nodiscard]] inline unsigned size() const { return (unsigned) _threads.size(); }
+
+    /* 进程内共享的线程池，线程数量是 CPU 的核心数，第一次调用时创建 */
+    static ThreadPool &shared() {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+
+private:
+    void _thread_func() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lck(_mtx);
+                _cv.wait(lck, [this]() { return _should_stop || !_tasks.empty(); });
+                if (_tasks.empty())
+                    return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _tasks;      /* 等待执行的任务 */
+    bool _should_stop = false;
+    std::vector<std::thread> _threads;
+};
+
+
+/**
+ * 使用多个线程并行地执行 func(i)，i 的范围是 [0, n)
+ * 线程通过原子计数器领取下标，每次领取 chunk 个，函数返回时所有的 func 都已经执行完毕
+ * 除了调用的线程之外，其余的线程来自 ThreadPool::shared()；线程池繁忙时，调用的线程会独自完成剩下的下标
+ * @param thread_cnt 线程的数量，为 1 时直接在当前线程执行
+ */
+template<class FuncT_>
+void parallel_for(size_t n, unsigned thread_cnt, size_t chunk, const FuncT_ &func) {
+    if (thread_cnt <= 1 || n <= chunk) {
+        for (size_t i = 0; i < n; ++i)
+            func(i);
+        return;
+    }
+
+    /* 线程池中的任务可能在函数返回之后才开始执行，共享的状态由 shared_ptr 持有；此时下标已经领取完了，不会再调用 func */
+    struct State {
+        std::atomic<size_t> next{0};
+        unsigned active = 0;                /* 正在执行的线程池任务数量 */
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+    auto state = std::make_shared<State>();
+
+    auto run = [n, chunk, &func](State &st) {
+        while (true) {
+            size_t begin = st.next.fetch_add(chunk);
+            if (begin >= n)
+                break;
+            size_t end = std::min(begin + chunk, n);
+            for (size_t i = begin; i < end; ++i)
+                func(i);
+        }
+    };
+
+    ThreadPool &pool = ThreadPool::shared();
+    unsigned helper_cnt = std::min(thread_cnt - 1, pool.size());
+    for (unsigned i = 0; i < helper_cnt; ++i) {
+        pool.submit([state, run]() {
+            {
+                std::lock_guard<std::mutex> lck(state->mtx);
+                ++state->active;
+            }
+            run(*state);
+            std::lock_guard<std::mutex> lck(state->mtx);
+            if (--state->active == 0)
+                state->cv.notify_all();
+        });
+    }
+
+    run(*state);
+    std::unique_lock<std::mutex> lck(state->mtx);
+    state->cv.wait(lck, [&]() { return state->active == 0; });
+}
+
+
 #endif //RENDER_DEBUG_TASK_H
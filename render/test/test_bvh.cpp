@@ -116,3 +116,71 @@ TEST_CASE("建立 BVH") {
     }
 }
 
+
+
+TEST_CASE("分桶的 SAH 构建") {
+    auto mat = std::shared_ptr<Material>(nullptr);
+
+    // 分布不均匀的三角形：大部分是一簇很小的三角形，少数是散布在远处的大三角形
+    std::vector<std::shared_ptr<Object>> objs;
+    random_seed_set(7);
+    for (int i = 0; i < 480; ++i) {
+        Eigen::Vector3f p = random_point_get(-1, 1);
+        objs.push_back(std::make_shared<Triangle>(p, p + random_point_get(0, 0.1f), p + random_point_get(0, 0.1f),
+                                                  mat));
+    }
+    for (int i = 0; i < 32; ++i) {
+        Eigen::Vector3f p = random_point_get(-50, 50);
+        objs.push_back(std::make_shared<Triangle>(p, p + random_point_get(0, 5), p + random_point_get(0, 5), mat));
+    }
+
+    auto median = BVH::build(objs);
+    auto sah    = BVH::build(objs, BVHBuildMethod::BinnedSAH);
+
+    SECTION("树的结构：每个物体恰好在一个叶子中") {
+        int leaf_cnt = 0, node_cnt = 0;
+        BVH_traverse(sah, [&](const BVH &node) {
+            ++node_cnt;
+            if (node.object()) {
+                ++leaf_cnt;
+                REQUIRE(node.lchild() == nullptr);
+                REQUIRE(node.rchild() == nullptr);
+            } else {
+                REQUIRE(node.lchild() != nullptr);
+                REQUIRE(node.rchild() != nullptr);
+            }
+        });
+        REQUIRE(leaf_cnt == objs.size());
+        REQUIRE(node_cnt == objs.size() * 2 - 1);
+        REQUIRE(sah->area() == Approx(median->area()));
+    }
+
+    SECTION("和中位数划分的求交结果相同") {
+        for (int i = 0; i < 1000; ++i) {
+            Ray ray(random_point_get(-60, 60), random_point_get(-1, 1));
+            auto a = median->intersect(ray);
+            auto b = sah->intersect(ray);
+            REQUIRE(a.happened() == b.happened());
+            if (a.happened())
+                REQUIRE(a.t_near() == Approx(b.t_near()));
+        }
+    }
+
+    SECTION("SAH 代价比中位数划分低") {
+        REQUIRE(sah->sah_cost() < median->sah_cost());
+
+        // 叶子的代价是物体的求交代价
+        BVH_traverse(sah, [](const BVH &node) {
+            if (node.object())
+                REQUIRE(node.sah_cost() == 1.f);
+        });
+    }
+
+    SECTION("重心重合的物体退化为中位数划分") {
+        std::vector<std::shared_ptr<Object>> same(5, objs[0]);
+        auto root = BVH::build(same, BVHBuildMethod::BinnedSAH);
+        int leaf_cnt = 0;
+        BVH_traverse(root, [&leaf_cnt](const BVH &node) { leaf_cnt += node.object() != nullptr; });
+        REQUIRE(leaf_cnt == 5);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_MAIN
+#endif
+
+#include <string>
+
+#include <fmt/format.h>
+#include <catch2/catch.hpp>
+
+#include "config.h"
+#include "utils.h"
+#include "denoiser.h"
+#include "triangle.h"
+#define private public
+#include "rt_render.h"
+#undef private
+
+
+/* 两幅图像之间的均方误差（亮度） */
+float mse(const std::vector<Eigen::Vector3f> &a, const std::vector<Eigen::Vector3f> &b)
+{
+    float sum = 0.f;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        float d = luminance(a[i]) - luminance(b[i]);
+        sum += d * d;
+    }
+    return sum / (float) a.size();
+}
+
+
+TEST_CASE("À-Trous 滤波")
+{
+    const int width = 64, height = 64;
+    AOVBuffer aov(width, height);
+
+    // 左右两半的法线和反射率不同，颜色是带有噪声的常数
+    std::vector<Eigen::Vector3f> truth(width * height), noisy(width * height);
+    for (int row = 0; row < height; ++row)
+    {
+        for (int col = 0; col < width; ++col)
+        {
+            size_t i = row * width + col;
+            bool left = col < width / 2;
+            aov.normal[i] = left ? Eigen::Vector3f(1.f, 0.f, 0.f) : Eigen::Vector3f(0.f, 1.f, 0.f);
+            aov.albedo[i] = left ? Eigen::Vector3f(0.8f, 0.1f, 0.1f) : Eigen::Vector3f(0.1f, 0.8f, 0.1f);
+            aov.depth[i] = 10.f;
+            truth[i] = left ? Eigen::Vector3f(0.2f, 0.2f, 0.2f) : Eigen::Vector3f(0.8f, 0.8f, 0.8f);
+            noisy[i] = truth[i] * (0.5f + random_float_get());
+        }
+    }
+
+    Denoiser::Options options;
+    options.tile_size = 16;
+    auto denoised = Denoiser::atrous(noisy, aov, options, 4);
+
+    SECTION("噪声明显降低")
+    {
+        REQUIRE(mse(denoised, truth) < 0.1f * mse(noisy, truth));
+    }
+
+    SECTION("边缘两侧的像素不会混合")
+    {
+        for (int row = 0; row < height; ++row)
+        {
+            REQUIRE(luminance(denoised[row * width + width / 2 - 1]) < 0.3f);
+            REQUIRE(luminance(denoised[row * width + width / 2]) > 0.6f);
+        }
+    }
+
+    SECTION("单线程和多线程的结果相同")
+    {
+        auto single = Denoiser::atrous(noisy, aov, options, 1);
+        for (size_t i = 0; i < single.size(); ++i)
+            REQUIRE(single[i] == denoised[i]);
+    }
+}
+
+
+TEST_CASE("低 spp 渲染后降噪")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(32, 32, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+
+    // 参考图像
+    RTRender render(scene, 128, 1);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    auto reference = render.radiance_buffer;
+
+    // 低 spp 的图像
+    render.init(scene, 4, 2);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    auto noisy = render.radiance_buffer;
+
+    // AOV 来自摄像机光线的交点
+    AOVBuffer aov = render.aov_get(4);
+    for (auto &task : RTRender::_prepare_render_task(scene))
+    {
+        auto inter = scene->intersect(task.ray);
+        size_t i = task.row * 32 + task.col;
+        REQUIRE(aov.depth[i] == Approx(inter.happened() ? inter.t_near() : 0.f).epsilon(epsilon_4));
+    }
+
+    // 降噪只会修改 framebuffer
+    render.denoise();
+    REQUIRE(render.radiance_buffer == noisy);
+
+    auto denoised = Denoiser::atrous(noisy, aov, {}, 4);
+    float mse_noisy = mse(noisy, reference);
+    float mse_denoised = mse(denoised, reference);
+    fmt::print("\nmse: noisy {}, denoised {}\n", mse_noisy, mse_denoised);
+    REQUIRE(mse_denoised < 0.5f * mse_noisy);
+}
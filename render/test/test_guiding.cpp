@@ -0,0 +1,164 @@
+#ifndef CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_MAIN
+#endif
+
+#include <fmt/format.h>
+#include <catch2/catch.hpp>
+
+#include "config.h"
+#include "task.h"
+#include "utils.h"
+#include "guiding.h"
+#include "triangle.h"
+#define private public
+#include "rt_render.h"
+#undef private
+
+
+/* 在 [0, 1)^2 上用网格积分 DTree 的 pdf */
+float pdf_integral(const DTree &tree, int n = 256)
+{
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            sum += tree.pdf({(i + 0.5f) / n, (j + 0.5f) / n});
+    return sum / (float) (n * n);
+}
+
+
+/* 画面中所有像素 radiance 的平均亮度 */
+float mean_luminance(const std::vector<Eigen::Vector3f> &buffer)
+{
+    float sum = 0.f;
+    for (auto &c : buffer)
+        sum += luminance(c);
+    return sum / (float) buffer.size();
+}
+
+
+TEST_CASE("方向与 [0, 1)^2 的映射")
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        Eigen::Vector2f p{random_float_get(), random_float_get()};
+        Direction dir = canonical_to_dir(p);
+        REQUIRE(dir.get().norm() == Approx(1.f));
+        Eigen::Vector2f q = dir_to_canonical(dir);
+        REQUIRE(q.x() == Approx(p.x()).margin(1e-4));
+        REQUIRE(q.y() == Approx(p.y()).margin(1e-4));
+    }
+}
+
+
+TEST_CASE("方向四叉树")
+{
+    // 能量集中在 [0.6, 0.7) x [0.2, 0.3) 内，其余地方有少量的能量
+    DTree tree;
+    for (int iter = 0; iter < 4; ++iter)
+    {
+        DTree building = tree.refined(0.01f, 16);
+        parallel_for(20000, 4, 256, [&](size_t) {
+            Eigen::Vector2f p{random_float_get(), random_float_get()};
+            bool hot = p.x() >= 0.6f && p.x() < 0.7f && p.y() >= 0.2f && p.y() < 0.3f;
+            building.record(p, hot ? 100.f : 1.f);
+        });
+        REQUIRE(building.record_cnt() == 20000);
+        tree = building;
+    }
+
+    SECTION("能量集中的区域被细分")
+    {
+        REQUIRE(tree.node_cnt() > 4);
+    }
+
+    SECTION("pdf 的积分为 1")
+    {
+        REQUIRE(pdf_integral(tree) == Approx(1.f).epsilon(0.01));
+    }
+
+    SECTION("采样集中在能量高的区域，且 pdf 和采样一致")
+    {
+        int hot_cnt = 0;
+        for (int i = 0; i < 10000; ++i)
+        {
+            Eigen::Vector2f p = tree.sample();
+            REQUIRE(tree.pdf(p) > 0.f);
+            hot_cnt += p.x() >= 0.6f && p.x() < 0.7f && p.y() >= 0.2f && p.y() < 0.3f;
+        }
+        // 能量占比约为 100 * 0.01 / (100 * 0.01 + 0.99) ≈ 0.5
+        REQUIRE(hot_cnt > 4000);
+    }
+
+    SECTION("没有记录时是均匀分布")
+    {
+        DTree empty;
+        REQUIRE(empty.pdf({0.3f, 0.8f}) == 1.f);
+        REQUIRE(empty.refined(0.01f, 16).node_cnt() == 1);
+    }
+}
+
+
+TEST_CASE("路径引导不改变渲染结果的期望")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(32, 32, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+
+    RTRender render;
+    render.integrator.light_sampling = LightSampling::MIS;
+
+    // 不使用路径引导
+    render.init(scene, 64, 1);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    float mean_plain = mean_luminance(render.radiance_buffer);
+
+    // 训练之后使用路径引导
+    render.init(scene, 64, 2);
+    PathGuiding::Options options;
+    options.spatial_threshold = 1000;
+    render.train_guiding(4, options);
+    REQUIRE(render.integrator.path_guiding);
+    REQUIRE(render.guiding->trained());
+    REQUIRE(render.guiding->leaf_cnt() > 1);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    float mean_guided = mean_luminance(render.radiance_buffer);
+
+    fmt::print("\nmean luminance: plain {}, guided {}\n", mean_plain, mean_guided);
+    REQUIRE(mean_guided == Approx(mean_plain).epsilon(0.05));
+
+    SECTION("学习到的分布在球面上积分为 1")
+    {
+        const int n = 256;
+        Eigen::Vector3f pos = scene->bounding_box().center();
+        float sum = 0.f;
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+                sum += render.guiding->pdf(pos, canonical_to_dir({(i + 0.5f) / n, (j + 0.5f) / n}));
+        REQUIRE(sum * 4.f * (float) M_PI / (float) (n * n) == Approx(1.f).epsilon(0.02));
+    }
+
+    SECTION("训练的结果是确定的：重新训练得到相同的渲染结果")
+    {
+        std::vector<Eigen::Vector3f> guided = render.radiance_buffer;
+        render.init(scene, 64, 2);
+        render.train_guiding(4, options);
+        render.render_atomic("", 5, RTRender::TileOrder::Scanline, RTRender::CaptureMode::None);
+        REQUIRE(render.radiance_buffer == guided);
+    }
+
+}
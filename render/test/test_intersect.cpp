@@ -69,8 +69,7 @@ TEST_CASE("三角形计算交点")
         auto inter = tri->intersect(ray);
 
         REQUIRE(inter.happened());
-        // todo 这里修复下
-        // REQUIRE(inter.obj() == std::static_pointer_cast<Object>(tri));
+        REQUIRE(inter.obj() == tri.get());
         REQUIRE(inter.normal().get() == tri->normal().get());
 
         // fixme: 计算三角形交点的算法误差比较大
@@ -226,3 +225,44 @@ TEST_CASE("在场景中采样，这个测试来源于一次渲染") {
     auto inter = scene->intersect(ray);
     spdlog::info("inter pos: ({}, {}, {})", inter.pos().x(), inter.pos().y(), inter.pos().z());
 }
+
+
+TEST_CASE("遮挡查询和最近交点的结果一致") {
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto tall_box = MeshTriangle::mesh_load(PATH_CORNELL_TALLBOX)[0];
+    tall_box->mat()->set_diffuse(color_cornel_white);
+    auto shot_box = MeshTriangle::mesh_load(PATH_CORNELL_SHORTBOX)[0];
+    shot_box->mat()->set_diffuse(color_cornel_white);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(200, 200, 40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(light);
+    scene->obj_add(tall_box);
+    scene->obj_add(shot_box);
+    scene->build();
+
+    // 场景内随机的线段，一部分被遮挡，一部分没有
+    int occluded_cnt = 0;
+    LOOP(10000) {
+        Eigen::Vector3f orig = random_point_get() * 556.f;
+        Eigen::Vector3f dir = random_point_get() - Eigen::Vector3f::Constant(0.5f);
+        if (dir.norm() < epsilon_3)
+            continue;
+        Ray ray{orig, dir};
+        float t_max = random_float_get() * 800.f;
+
+        auto inter = scene->intersect(ray);
+        bool expected = inter.happened() && inter.t_near() < t_max;
+        REQUIRE(scene->occluded(ray, t_max) == expected);
+        occluded_cnt += expected;
+    }
+    REQUIRE(occluded_cnt > 0);
+    REQUIRE(occluded_cnt < 10000);
+}
@@ -0,0 +1,145 @@
+#ifndef CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_MAIN
+#endif
+
+#include <string>
+#include <chrono>
+#include <limits>
+
+#include <fmt/format.h>
+#include <catch2/catch.hpp>
+
+#include "utils.h"
+#include "config.h"
+#include "triangle.h"
+#include "ray_packet.h"
+#define private public
+#include "rt_render.h"
+#undef private
+
+
+/* 构建 cornell-box 场景 */
+static std::shared_ptr<Scene> cornell_scene(int width, int height)
+{
+    auto scene = std::make_shared<Scene>(width, height, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    for (auto path : {PATH_CORNELL_FLOOR, PATH_CORNELL_LEFT, PATH_CORNELL_RIGHT, PATH_CORNELL_TALLBOX,
+                      PATH_CORNELL_SHORTBOX, PATH_CORNELL_LIGHT})
+        scene->obj_add(MeshTriangle::mesh_load(path)[0]);
+    scene->build();
+    return scene;
+}
+
+
+/* 将摄像机光线打包，和场景求交，结果按照光线的顺序排列 */
+template<int N_>
+static std::vector<Intersection> intersect_packets(const Scene &scene,
+                                                   const std::vector<RTRender::RenderPixelTask> &tasks)
+{
+    std::vector<Intersection> res;
+    res.reserve(tasks.size());
+    for (size_t begin = 0; begin < tasks.size(); begin += N_)
+    {
+        RayPacket<N_> packet;
+        for (size_t i = begin; i < std::min(begin + N_, tasks.size()); ++i)
+            packet.set((int) (i - begin), tasks[i].ray);
+        PacketHit<N_> hit;
+        scene.intersect(packet, hit);
+        for (size_t i = begin; i < std::min(begin + N_, tasks.size()); ++i)
+            res.push_back(hit.inter[i - begin]);
+    }
+    return res;
+}
+
+
+TEST_CASE("光线包和包围盒求交，与单根光线的结果一致")
+{
+    BoundingBox box(Eigen::Vector3f(-1.f, -1.f, -1.f), Eigen::Vector3f(1.f, 1.f, 1.f));
+
+    // 没有体积的包围盒，和 cornell-box 的墙面一样
+    BoundingBox flat(Eigen::Vector3f(-1.f, -1.f, 0.f), Eigen::Vector3f(1.f, 1.f, 0.f));
+
+    LOOP(100)
+    {
+        RayPacket<8> packet;
+        for (int lane = 0; lane < 8; ++lane)
+            packet.set(lane, Ray(random_point_get(-3.f, 3.f), Direction(random_point_get(-1.f, 1.f))));
+
+        PacketHit<8> hit;
+        uint32_t mask      = packet_intersect_box(box, packet, hit, packet.mask);
+        uint32_t mask_flat = packet_intersect_box(flat, packet, hit, packet.mask);
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            REQUIRE(bool(mask >> lane & 1u) == box.isIntersect(packet.ray(lane)));
+            REQUIRE(bool(mask_flat >> lane & 1u) == flat.isIntersect(packet.ray(lane)));
+        }
+    }
+}
+
+
+TEST_CASE("摄像机光线包和场景求交，与单根光线的结果一致")
+{
+    auto scene = cornell_scene(64, 64);
+    RTRender render(scene, 1);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    auto inters4 = intersect_packets<4>(*scene, tasks);
+    auto inters8 = intersect_packets<8>(*scene, tasks);
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        Intersection inter = scene->intersect(tasks[i].ray);
+        for (auto *packet_inter : {&inters4[i], &inters8[i]})
+        {
+            REQUIRE(packet_inter->happened() == inter.happened());
+            if (inter.happened())
+                REQUIRE(std::abs(packet_inter->t_near() - inter.t_near()) <= epsilon_4 * inter.t_near());
+        }
+    }
+}
+
+
+TEST_CASE("摄像机光线：光线包和单根光线的性能对比", "[benchmark]")
+{
+    auto scene = cornell_scene(256, 256);
+    RTRender render(scene, 1);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    /* 统计函数执行多轮的耗时，取最快的一轮，减少其他进程的干扰 */
+    auto time_us = [](auto &&func) {
+        long long best = std::numeric_limits<long long>::max();
+        LOOP(4)
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            func();
+            auto end_time = std::chrono::steady_clock::now();
+            best = std::min(best, (long long) std::chrono::duration_cast<std::chrono::microseconds>(
+                    end_time - start_time).count());
+        }
+        return best;
+    };
+
+    int scalar_hit = 0, packet4_hit = 0, packet8_hit = 0;
+    auto scalar_us = time_us([&]() {
+        scalar_hit = 0;
+        for (auto &task : tasks)
+            scalar_hit += scene->intersect(task.ray).happened();
+    });
+    auto count_hit = [](const std::vector<Intersection> &inters) {
+        int cnt = 0;
+        for (auto &inter : inters)
+            cnt += inter.happened();
+        return cnt;
+    };
+    auto packet4_us = time_us([&]() { packet4_hit = count_hit(intersect_packets<4>(*scene, tasks)); });
+    auto packet8_us = time_us([&]() { packet8_hit = count_hit(intersect_packets<8>(*scene, tasks)); });
+
+    fmt::print("摄像机光线 {} 根，4 轮中最快的一轮\n单根光线: {}us\n4 路光线包: {}us\n8 路光线包: {}us\n",
+               tasks.size(), scalar_us, packet4_us, packet8_us);
+
+    // 得到的交点数量相同，并且光线包比单根光线快
+    REQUIRE(scalar_hit > 0);
+    REQUIRE(packet4_hit == scalar_hit);
+    REQUIRE(packet8_hit == scalar_hit);
+    REQUIRE(packet4_us < scalar_us);
+    REQUIRE(packet8_us < scalar_us);
+}
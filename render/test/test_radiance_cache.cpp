@@ -0,0 +1,145 @@
+#ifndef CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_MAIN
+#endif
+
+#include <fmt/format.h>
+#include <catch2/catch.hpp>
+
+#include "config.h"
+#include "task.h"
+#include "utils.h"
+#include "radiance_cache.h"
+#include "triangle.h"
+#define private public
+#include "rt_render.h"
+#undef private
+
+
+/* 画面中所有像素 radiance 的平均亮度 */
+float mean_luminance(const std::vector<Eigen::Vector3f> &buffer)
+{
+    float sum = 0.f;
+    for (auto &c : buffer)
+        sum += luminance(c);
+    return sum / (float) buffer.size();
+}
+
+
+/* 所有像素的第一个采样，路径的平均节点数 */
+float mean_path_length(RTRender &render)
+{
+    PathBuffer buffer;
+    size_t total = 0;
+    auto task_list = RTRender::_prepare_render_task(render._scene);
+    for (auto &task : task_list)
+    {
+        auto [ray, primary] = render._primary_get(task.col, task.row, 0);
+        render.trace_path<FullPath>(ray, primary, buffer);
+        total += buffer.size();
+    }
+    return (float) total / (float) task_list.size();
+}
+
+
+TEST_CASE("radiance 缓存的插入和查询")
+{
+    BoundingBox bounds(Eigen::Vector3f(0.f, 0.f, 0.f), Eigen::Vector3f(64.f, 64.f, 64.f));
+    RadianceCache::Options options;
+    options.cell_size = 1.f;
+    options.min_count = 16;
+    RadianceCache cache(bounds, options);
+    const Direction N(Eigen::Vector3f(0.f, 1.f, 0.f));
+
+    SECTION("多个线程同时插入")
+    {
+        parallel_for(64000, 8, 64, [&](size_t i) {
+            Eigen::Vector3f pos((float) (i % 64) + 0.5f, 3.5f, 7.5f);
+            cache.insert(pos, N, Eigen::Vector3f(1.f, 2.f, 3.f));
+        });
+        REQUIRE(cache.entry_cnt() == 64);
+        REQUIRE(cache.valid_cnt() == 64);
+
+        Eigen::Vector3f Lo;
+        REQUIRE(cache.query({10.2f, 3.9f, 7.1f}, N, Lo));
+        REQUIRE(Lo.isApprox(Eigen::Vector3f(1.f, 2.f, 3.f)));
+
+        // 网格相同，但是法线不同
+        REQUIRE_FALSE(cache.query({10.2f, 3.9f, 7.1f}, Direction(Eigen::Vector3f(1.f, 0.f, 0.f)), Lo));
+        // 没有插入过的网格
+        REQUIRE_FALSE(cache.query({10.2f, 5.5f, 7.1f}, N, Lo));
+    }
+
+    SECTION("样本数不足时不能查询")
+    {
+        for (uint32_t i = 0; i + 1 < options.min_count; ++i)
+            cache.insert({0.5f, 0.5f, 0.5f}, N, Eigen::Vector3f(1.f, 1.f, 1.f));
+        Eigen::Vector3f Lo;
+        REQUIRE_FALSE(cache.query({0.5f, 0.5f, 0.5f}, N, Lo));
+        cache.insert({0.5f, 0.5f, 0.5f}, N, Eigen::Vector3f(1.f, 1.f, 1.f));
+        REQUIRE(cache.query({0.5f, 0.5f, 0.5f}, N, Lo));
+    }
+
+    SECTION("误差超过上限时不能查询")
+    {
+        // 一半是 0，一半是 2：相对标准差为 1，需要 100 个样本才能达到 0.1 的相对误差
+        for (int i = 0; i < 64; ++i)
+            cache.insert({0.5f, 0.5f, 0.5f}, N, Eigen::Vector3f::Constant(i % 2 ? 2.f : 0.f));
+        Eigen::Vector3f Lo;
+        REQUIRE_FALSE(cache.query({0.5f, 0.5f, 0.5f}, N, Lo));
+        for (int i = 0; i < 64; ++i)
+            cache.insert({0.5f, 0.5f, 0.5f}, N, Eigen::Vector3f::Constant(i % 2 ? 2.f : 0.f));
+        REQUIRE(cache.query({0.5f, 0.5f, 0.5f}, N, Lo));
+        REQUIRE(Lo.isApprox(Eigen::Vector3f::Ones()));
+    }
+}
+
+
+TEST_CASE("使用 radiance 缓存渲染")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(32, 32, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render;
+
+    // 不使用缓存
+    render.init(scene, 64, 1);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    float mean_plain   = mean_luminance(render.radiance_buffer);
+    float length_plain = mean_path_length(render);
+
+    // 使用缓存：画面很小，样本数量少，使用较大的网格
+    render.init(scene, 64, 2);
+    RadianceCache::Options options;
+    options.cell_size = scene->bounding_box().diagonal().norm() / 16.f;
+    render.cache_enable(options);
+    REQUIRE(render.integrator.radiance_cache);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    float mean_cached   = mean_luminance(render.radiance_buffer);
+    float length_cached = mean_path_length(render);
+
+    fmt::print("\nmean luminance: plain {}, cached {}; path length: plain {}, cached {}; cache entries: {}/{}\n",
+               mean_plain, mean_cached, length_plain, length_cached,
+               render.cache->valid_cnt(), render.cache->entry_cnt());
+    REQUIRE(render.cache->valid_cnt() > 0);
+    REQUIRE(mean_cached == Approx(mean_plain).epsilon(0.05));
+    REQUIRE(length_cached * 2.f < length_plain);
+
+    // init 会丢弃缓存
+    render.init(scene, 64, 3);
+    REQUIRE_FALSE(render._cache_active());
+}
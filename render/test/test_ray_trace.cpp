@@ -32,11 +32,11 @@ TEST_CASE("场景中一根光线的弹射情况") {
     scene->build();
 
     // 建立 Render 对象
-    RTRender::init(scene, 1);
+    RTRender render(scene, 1);
 
     // 投射光线
     Ray ray({250.f, 250.f, 0.f}, {0.357f, 0.257f, 1.f});
-    std::deque<PathNode> path = RTRender::cast_ray(ray);
+    std::deque<PathNode> path = render.cast_ray(ray);
     fmt::print("path node cnt: {}\n", path.size());
 }
 
@@ -58,9 +58,297 @@ TEST_CASE("验证路径信息是否完备") {
     scene->build();
 
     // 建立 Render 对象
-    RTRender::init(scene, 1);
+    RTRender render(scene, 1);
 
     // 投射光线
     Ray ray({250.f, 250.f, 0.f}, {0.357f, 0.257f, 1.f});
-    std::deque<PathNode> path = RTRender::cast_ray(ray);
+    std::deque<PathNode> path = render.cast_ray(ray);
+}
+
+TEST_CASE("迭代式积分器：路径节点的 Lo 与返回的 radiance 一致") {
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20, 20, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 1);
+
+    PathBuffer buffer;
+    auto tasks = RTRender::_prepare_render_task(scene);
+    for (auto &task : tasks) {
+        Eigen::Vector3f radiance = render.trace_path(task.ray, buffer);
+        REQUIRE(buffer.size() > 0);
+        REQUIRE((radiance - buffer[0].Lo).norm() <= epsilon_3 * std::max(1.f, radiance.norm()));
+
+        // 每个节点的 Lo = 直接光照 + 下一个节点的 Lo * weight
+        for (int i = 0; i + 1 < buffer.size(); ++i) {
+            REQUIRE(buffer[i].from_obj.Li_obj == buffer[i + 1].Lo);
+            REQUIRE(buffer[i].from_obj.inter_obj.happened());
+        }
+    }
+}
+
+
+TEST_CASE("积分器的路径记录策略") {
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16, 16, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 4);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    SECTION("不同的策略，路径列表的内容不同") {
+        auto &task = tasks[tasks.size() / 2];
+        auto none = (render.*render.pixel_job(RTRender::CaptureMode::None))(task);
+        auto radiance = (render.*render.pixel_job(RTRender::CaptureMode::RadianceOnly))(task);
+        auto full = (render.*render.pixel_job(RTRender::CaptureMode::FullPath))(task);
+
+        REQUIRE(none->path_list.empty());
+        REQUIRE(radiance->path_list.size() == 4);
+        REQUIRE(full->path_list.size() == 4);
+        for (auto &path : radiance->path_list)
+            REQUIRE(path.size() == 1);
+
+        // 像素的 radiance 是所有采样的均值
+        Eigen::Vector3f sum{0.f, 0.f, 0.f};
+        for (auto &path : full->path_list)
+            sum += path.front().Lo;
+        REQUIRE((sum / 4.f - full->radiance).norm() <= epsilon_3 * std::max(1.f, sum.norm()));
+    }
+
+    SECTION("不记录路径时，多次采样的均值和记录路径时一致") {
+        // 两种策略各自渲染整个画面，比较平均亮度
+        PathBuffer buffer;
+        Eigen::Vector3f sum_none{0.f, 0.f, 0.f};
+        Eigen::Vector3f sum_full{0.f, 0.f, 0.f};
+        LOOP(16) {
+            for (auto &task : tasks) {
+                sum_none += render.trace_path<NoCapture>(task.ray, buffer);
+                sum_full += render.trace_path<FullPath>(task.ray, buffer);
+            }
+        }
+        REQUIRE((sum_none - sum_full).norm() <= 0.1f * sum_full.norm());
+    }
+
+    SECTION("不记录路径时不需要数据库") {
+        render.render_single_thread("", RTRender::CaptureMode::None);
+        int lit = 0;
+        for (auto &pixel : render.framebuffer)
+            lit += (pixel[0] + pixel[1] + pixel[2]) > 0;
+        REQUIRE(lit > 0);
+    }
+}
+
+
+TEST_CASE("通过采样的种子重建光路") {
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16, 16, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 4, 7);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    SECTION("重建的光路和渲染时记录的光路相同") {
+        for (int idx : {0, 37, 136, 255}) {
+            auto &task = tasks[idx];
+            auto res = (render.*render.pixel_job(RTRender::CaptureMode::FullPath))(task);
+            for (int s = 0; s < 4; ++s) {
+                auto path = render.reconstruct_path(task.col, task.row, s);
+                auto &expected = res->path_list[s];
+                REQUIRE(path.size() == expected.size());
+                for (size_t i = 0; i < path.size(); ++i) {
+                    REQUIRE(path[i].Lo == expected[i].Lo);
+                    REQUIRE(path[i].from_obj.wi_obj.get() == expected[i].from_obj.wi_obj.get());
+                }
+            }
+        }
+    }
+
+    SECTION("不记录光路时，像素的 radiance 和记录时相同") {
+        auto &task = tasks[tasks.size() / 2];
+        auto none = (render.*render.pixel_job(RTRender::CaptureMode::None))(task);
+        auto full = (render.*render.pixel_job(RTRender::CaptureMode::FullPath))(task);
+        REQUIRE(none->radiance == full->radiance);
+    }
+
+    SECTION("不同的渲染 id 得到不同的采样") {
+        std::vector<std::deque<PathNode>> paths_a;
+        for (auto &task : tasks)
+            paths_a.push_back(render.reconstruct_path(task.col, task.row, 0));
+        render.init(scene, 4, 8);
+        int diff_cnt = 0;
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            auto path_b = render.reconstruct_path(tasks[t].col, tasks[t].row, 0);
+            diff_cnt += path_b.size() != paths_a[t].size() || path_b.front().Lo != paths_a[t].front().Lo;
+        }
+        REQUIRE(diff_cnt > 0);
+    }
+}
+
+
+TEST_CASE("多重重要性采样和只对光源采样的期望相同") {
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16, 16, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 1);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    // 光源上的点的 pdf 是光源总面积的倒数
+    auto [pdf_light, inter_light] = scene->sample_light();
+    REQUIRE(inter_light.happened());
+    REQUIRE(pdf_light == Approx(scene->pdf_light(inter_light)));
+    REQUIRE(pdf_light == Approx(1.f / light->area()));
+
+    // 整个画面的平均 radiance
+    auto average = [&](LightSampling light_sampling) {
+        render.integrator.light_sampling = light_sampling;
+        PathBuffer buffer;
+        Eigen::Vector3f sum{0.f, 0.f, 0.f};
+        LOOP(64) {
+            for (auto &task : tasks)
+                sum += render.trace_path<NoCapture>(task.ray, buffer);
+        }
+        return Eigen::Vector3f(sum / (64.f * (float) tasks.size()));
+    };
+    Eigen::Vector3f nee = average(LightSampling::NEE);
+    Eigen::Vector3f mis = average(LightSampling::MIS);
+    render.integrator = {};
+    REQUIRE((nee - mis).norm() <= 0.05f * nee.norm());
+
+    SECTION("记录的路径仍然满足 Lo = 直接光照 + 下一个节点的 Lo * weight") {
+        render.integrator.light_sampling = LightSampling::MIS;
+        PathBuffer buffer;
+        for (auto &task : tasks) {
+            Eigen::Vector3f radiance = render.trace_path<FullPath>(task.ray, buffer);
+            REQUIRE((radiance - buffer[0].Lo).norm() <= epsilon_3 * std::max(1.f, radiance.norm()));
+        }
+        render.integrator = {};
+    }
+}
+
+
+TEST_CASE("路径长度的策略") {
+    SECTION("继续的概率") {
+        PathTermination termination;
+        REQUIRE(termination.survival_probability(1, {1.f, 1.f, 1.f}) == Approx(0.8f));
+
+        termination.min_depth = 3;
+        termination.max_depth = 5;
+        termination.throughput_based = true;
+        REQUIRE(termination.survival_probability(2, {0.f, 0.f, 0.f}) == 1.f);
+        REQUIRE(termination.survival_probability(3, {0.3f, 0.5f, 0.1f}) == Approx(0.5f));
+        REQUIRE(termination.survival_probability(3, {0.f, 0.f, 0.f}) == Approx(termination.min_survival));
+        REQUIRE(termination.survival_probability(4, {4.f, 4.f, 4.f}) == Approx(termination.max_survival));
+        REQUIRE(termination.survival_probability(5, {1.f, 1.f, 1.f}) == 0.f);
+    }
+
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16, 16, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 1);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    SECTION("路径的节点数不超过 max_depth") {
+        render.integrator.termination.max_depth = 2;
+        PathBuffer buffer;
+        LOOP(8) {
+            for (auto &task : tasks) {
+                render.trace_path<FullPath>(task.ray, buffer);
+                REQUIRE(buffer.size() <= 2);
+            }
+        }
+        render.integrator = {};
+    }
+
+    SECTION("基于 throughput 的俄罗斯轮盘赌，期望和默认的策略相同") {
+        auto average = [&](const PathTermination &termination) {
+            render.integrator.termination = termination;
+            PathBuffer buffer;
+            Eigen::Vector3f sum{0.f, 0.f, 0.f};
+            LOOP(64) {
+                for (auto &task : tasks)
+                    sum += render.trace_path<NoCapture>(task.ray, buffer);
+            }
+            render.integrator = {};
+            return Eigen::Vector3f(sum / (64.f * (float) tasks.size()));
+        };
+
+        PathTermination throughput_based;
+        throughput_based.min_depth = 2;
+        throughput_based.throughput_based = true;
+        Eigen::Vector3f expected = average(PathTermination{});
+        Eigen::Vector3f actual = average(throughput_based);
+        REQUIRE((expected - actual).norm() <= 0.05f * expected.norm());
+    }
 }
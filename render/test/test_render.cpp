@@ -6,6 +6,7 @@
 
 #include <catch2/catch.hpp>
 #include <string>
+#include <thread>
 
 #include "triangle.h"
 #include "utils.h"
@@ -22,7 +23,7 @@ TEST_CASE("测试生成的任务是否正确")
                                          45.f,
                                          Eigen::Vector3f(0.f, 0.f, 1.f),
                                          Eigen::Vector3f(100.f, 100.f, 0.f));
-    RTRender::init(scene, 16);
+    RTRender render(scene, 16);
     auto tasks = RTRender::_prepare_render_task(scene);
 
     REQUIRE(tasks.size() == 4);
@@ -118,10 +119,841 @@ TEST_CASE("单线程小规模的计算任务")
     scene->build();
 
     // 进行渲染
-    RTRender::init(scene, 1);
-    RTRender::render_single_thread(DB_PATH);
-    RTRender::write_to_file(RTRender::framebuffer,
+    RTRender render(scene, 1);
+    render.render_single_thread(DB_PATH);
+    RTRender::write_to_file(render.framebuffer,
                             RT_RES,
                             scene->screen_width(),
                             scene->screen_height());
 }
+
+TEST_CASE("wavefront 模式渲染")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20,
+                                         20,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+
+    // 批次的大小不能整除采样总数，确保最后一批也被处理
+    const int spp = 64;
+    RTRender render(scene, spp);
+    render.render_wavefront(333);
+
+    int lit_pixel_cnt = 0;
+    for (auto &pixel : render.framebuffer)
+        if (pixel[0] || pixel[1] || pixel[2])
+            ++lit_pixel_cnt;
+    REQUIRE(lit_pixel_cnt > 0);
+    for (auto &radiance : render.radiance_buffer)
+        REQUIRE(radiance.allFinite());
+
+    // 整个画面的平均 radiance 和逐根光线的迭代积分器相同：同样的光线，同样的 spp
+    Eigen::Vector3f wavefront{0.f, 0.f, 0.f};
+    for (auto &radiance : render.radiance_buffer)
+        wavefront += radiance;
+    wavefront /= (float) render.radiance_buffer.size();
+
+    auto tasks = RTRender::_prepare_render_task(scene);
+    PathBuffer buffer;
+    Eigen::Vector3f scalar{0.f, 0.f, 0.f};
+    for (int i = 0; i < spp; ++i)
+        for (auto &task : tasks)
+            scalar += render.trace_path<NoCapture>(task.ray, buffer);
+    scalar /= (float) (spp * tasks.size());
+
+    fmt::print("\nmean luminance: wavefront {}, scalar {}\n", luminance(wavefront), luminance(scalar));
+    REQUIRE((wavefront - scalar).norm() <= 0.05f * scalar.norm());
+}
+
+TEST_CASE("结果和线程数量、调度顺序无关")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20, 20, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+
+    SECTION("逐像素渲染：线程数量和区块顺序不影响结果")
+    {
+        RTRender single(scene, 8, 5);
+        single.render_to_memory(1);
+
+        RTRender multi(scene, 8, 5);
+        multi.render_to_memory(8);
+        REQUIRE(multi.radiance_buffer == single.radiance_buffer);
+
+        RTRender atomic(scene, 8, 5);
+        atomic.render_atomic("", 3, RTRender::TileOrder::Morton, RTRender::CaptureMode::None);
+        REQUIRE(atomic.radiance_buffer == single.radiance_buffer);
+        REQUIRE(atomic.framebuffer == single.framebuffer);
+    }
+
+    SECTION("wavefront：批的大小不影响结果")
+    {
+        RTRender small(scene, 4, 5);
+        small.render_wavefront(333);
+
+        RTRender large(scene, 4, 5);
+        large.render_wavefront(1 << 16);
+        REQUIRE(large.radiance_buffer == small.radiance_buffer);
+
+        large.render_wavefront(1 << 16);
+        REQUIRE(large.radiance_buffer == small.radiance_buffer);
+    }
+}
+
+TEST_CASE("渐进式渲染")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20,
+                                         20,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 1);
+
+    SECTION("时间预算用完后停止，至少完成一轮")
+    {
+        int spp = render.render_progressive(1, 0.f, 2);
+        REQUIRE(spp >= 2);
+        REQUIRE(spp % 2 == 0);
+        REQUIRE(render.film.at(10, 10).spp == spp);
+    }
+
+    SECTION("达到噪声目标后停止，每一轮都会更新 framebuffer")
+    {
+        std::vector<int> pass_spp;
+        int spp = render.render_progressive(60 * 1000, 1e6f, 1, [&](int cur_spp) {
+            pass_spp.push_back(cur_spp);
+            REQUIRE(render.framebuffer[10 * 20 + 10] ==
+                    RTRender::gamma_correct(render.film.at(10, 10).radiance()));
+        });
+
+        // 至少需要 2 个采样才能估计方差
+        REQUIRE(spp == 2);
+        REQUIRE(pass_spp == std::vector<int>{1, 2});
+    }
+}
+
+TEST_CASE("自适应采样")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20,
+                                         20,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 1);
+
+    SECTION("阈值很大时，所有像素只有 base_spp 个采样")
+    {
+        size_t sample_cnt = render.render_adaptive(4, 16, 1e6f, 4, 4);
+        REQUIRE(sample_cnt == 20 * 20 * 4);
+        for (auto &pixel : render.film.pixels())
+            REQUIRE(pixel.spp == 4);
+    }
+
+    SECTION("阈值为 0 时，有噪声的像素达到 max_spp，没有噪声的像素保持 base_spp")
+    {
+        size_t sample_cnt = render.render_adaptive(4, 10, 0.f, 4, 4);
+
+        size_t total = 0;
+        for (auto &pixel : render.film.pixels())
+        {
+            REQUIRE(pixel.spp == (pixel.variance() > 0.f ? 10 : 4));
+            total += pixel.spp;
+        }
+        REQUIRE(total == sample_cnt);
+
+        // 采样数量图：采样最多的像素为白色
+        auto spp_map = RTRender::sample_count_map(render.film);
+        REQUIRE(spp_map.size() == 20 * 20);
+        for (size_t i = 0; i < spp_map.size(); ++i)
+            REQUIRE(spp_map[i][0] == (render.film.pixels()[i].spp == 10 ? 255 : 255 * 4 / 10));
+    }
+}
+
+TEST_CASE("按照区块划分渲染任务")
+{
+    auto scene = std::make_shared<Scene>(37,
+                                         37,
+                                         45.f,
+                                         Eigen::Vector3f(0.f, 0.f, 1.f),
+                                         Eigen::Vector3f(100.f, 100.f, 0.f));
+    RTRender render(scene, 1);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    for (auto order : {RTRender::TileOrder::Scanline, RTRender::TileOrder::Morton, RTRender::TileOrder::Hilbert})
+    {
+        // 37 = 8 * 4 + 5，最后一行和最后一列的区块不完整
+        auto tiles = RTRender::_prepare_render_tiles(scene, 8, order);
+        REQUIRE(tiles.size() == 5 * 5);
+
+        // 每个像素恰好出现一次，光线和 _prepare_render_task 的相同
+        std::vector<int> pixel_cnt(37 * 37, 0);
+        for (auto &tile : tiles)
+        {
+            for (auto &task : tile.tasks)
+            {
+                auto &expected = tasks[task.row * 37 + task.col];
+                REQUIRE((task.ray.direction().get() - expected.ray.direction().get()).norm() < epsilon_7);
+                ++pixel_cnt[task.row * 37 + task.col];
+            }
+        }
+        for (int cnt : pixel_cnt)
+            REQUIRE(cnt == 1);
+
+        // Hilbert 顺序中，相邻的两个区块在画面上也是相邻的（完整网格 4x4 的部分）
+        if (order == RTRender::TileOrder::Hilbert)
+        {
+            for (size_t i = 0; i + 1 < 16; ++i)
+            {
+                int dr = std::abs(tiles[i].tasks[0].row - tiles[i + 1].tasks[0].row) / 8;
+                int dc = std::abs(tiles[i].tasks[0].col - tiles[i + 1].tasks[0].col) / 8;
+                REQUIRE(dr + dc == 1);
+            }
+        }
+
+        // Morton 顺序中，前 4 个区块组成左上角 2x2 的区域
+        if (order == RTRender::TileOrder::Morton)
+        {
+            for (size_t i = 0; i < 4; ++i)
+            {
+                REQUIRE(tiles[i].tasks[0].row < 16);
+                REQUIRE(tiles[i].tasks[0].col < 16);
+            }
+        }
+    }
+}
+
+TEST_CASE("只渲染并记录一个区域")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20,
+                                         20,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 2);
+
+    // 和 _prepare_render_task 使用相同的摄像机映射
+    auto tasks = RTRender::_prepare_render_task(scene);
+    for (auto &task : tasks)
+    {
+        auto pixel_task = RTRender::_prepare_pixel_task(scene, task.col, task.row);
+        REQUIRE(pixel_task.ray.direction().get() == task.ray.direction().get());
+    }
+
+    // 区域超出了画面的右下角，超出的部分会被忽略
+    RTRender::PixelRect rect{15, 16, 8, 8};
+    render.render_region(DB_PATH, rect);
+
+    // 数据库中只有区域内的像素
+    DB::init_db(DB_PATH);
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(DB::db, "SELECT row, col FROM path", -1, &stmt, nullptr);
+    int path_cnt = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        int row = sqlite3_column_int(stmt, 0);
+        int col = sqlite3_column_int(stmt, 1);
+        REQUIRE((row >= 16 && row < 20 && col >= 15 && col < 20));
+        ++path_cnt;
+    }
+    sqlite3_finalize(stmt);
+    DB::close_db();
+    REQUIRE(path_cnt == 4 * 5 * 2);
+
+    // 区域外的像素只写入 framebuffer
+    render.init(scene, 2);
+    render.render_pixels(DB_PATH, {{3, 4}, {3, 4}, {-1, 0}}, true);
+    int lit = 0;
+    for (auto &pixel : render.framebuffer)
+        lit += (pixel[0] + pixel[1] + pixel[2]) > 0;
+    REQUIRE(lit > 1);
+}
+
+TEST_CASE("主光线的 G-buffer")
+{
+    // 子像素偏移在像素内，第 0 个是像素中心
+    REQUIRE(GBuffer::jitter_offset(0) == Eigen::Vector2f(0.5f, 0.5f));
+    for (int k = 0; k < 64; ++k)
+    {
+        Eigen::Vector2f offset = GBuffer::jitter_offset(k);
+        REQUIRE((offset.x() >= 0.f && offset.x() < 1.f && offset.y() >= 0.f && offset.y() < 1.f));
+    }
+
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16,
+                                         16,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 8);
+    render.integrator.primary_offsets = 4;
+    auto tasks = RTRender::_prepare_render_task(scene);
+    render._build_gbuffer(tasks, 4);
+
+    SECTION("每个像素、每个偏移的交点都只计算一次")
+    {
+        REQUIRE(render.gbuffer.offset_cnt() == 4);
+        for (auto &task : tasks)
+        {
+            REQUIRE(render.gbuffer.ready(task.row, task.col));
+            for (int k = 0; k < 4; ++k)
+            {
+                auto ray = RTRender::_prepare_pixel_task(scene, task.col, task.row, GBuffer::jitter_offset(k)).ray;
+                auto inter = scene->intersect(ray);
+                auto &cached = render.gbuffer.at(task.row, task.col, k);
+                // gbuffer 以光线包求交，和单根光线的浮点运算顺序不同，交点只在误差范围内相同
+                REQUIRE(cached.happened() == inter.happened());
+                REQUIRE((cached.pos() - inter.pos()).norm() <= epsilon_4 * std::max(1.f, inter.pos().norm()));
+                REQUIRE(cached.obj() == inter.obj());
+                REQUIRE(cached.happened() == (cached.obj() != nullptr));
+            }
+        }
+    }
+
+    SECTION("任务的顺序、重复的任务和线程数量不影响光线包的结果")
+    {
+        // 打乱顺序，并且包含重复的像素：和整个画面一起求交的结果完全相同
+        std::vector<RTRender::RenderPixelTask> shuffled(tasks.rbegin(), tasks.rend());
+        shuffled.insert(shuffled.end(), tasks.begin(), tasks.begin() + 37);
+        RTRender other(scene, 8);
+        other.integrator.primary_offsets = 4;
+        other._build_gbuffer(shuffled, 1);
+        for (auto &task : tasks)
+        {
+            REQUIRE(other.gbuffer.ready(task.row, task.col));
+            for (int k = 0; k < 4; ++k)
+            {
+                auto &a = other.gbuffer.at(task.row, task.col, k);
+                auto &b = render.gbuffer.at(task.row, task.col, k);
+                REQUIRE(a.obj() == b.obj());
+                REQUIRE(a.pos() == b.pos());
+            }
+        }
+    }
+
+    SECTION("像素的采样轮流使用各个子像素偏移，并且可以重建")
+    {
+        auto &task = tasks[tasks.size() / 2 + 3];
+        auto res = (render.*render.pixel_job(RTRender::CaptureMode::FullPath))(task);
+        for (int s = 0; s < 8; ++s)
+        {
+            auto ray = RTRender::_prepare_pixel_task(scene, task.col, task.row, GBuffer::jitter_offset(s % 4)).ray;
+            REQUIRE(res->path_list[s].front().wo.get() == (-ray.direction()).get());
+
+            auto path = render.reconstruct_path(task.col, task.row, s);
+            REQUIRE(path.size() == res->path_list[s].size());
+            REQUIRE(path.front().Lo == res->path_list[s].front().Lo);
+        }
+    }
+
+}
+
+TEST_CASE("预览用的积分器")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto tall_box = MeshTriangle::mesh_load(PATH_CORNELL_TALLBOX)[0];
+    tall_box->mat()->set_diffuse(color_cornel_white);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16,
+                                         16,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(tall_box);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 4);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    // 所有像素的平均值
+    auto average = [&](IntegratorType type) {
+        render.integrator.type = type;
+        PathBuffer buffer;
+        Eigen::Vector3f sum{0.f, 0.f, 0.f};
+        for (auto &task : tasks)
+        {
+            Eigen::Vector3f value = render.trace_path<FullPath>(task.ray, buffer);
+            if (type != IntegratorType::PathTracing)
+                REQUIRE(buffer.size() == 1);
+            if (type != IntegratorType::DirectLighting && type != IntegratorType::PathTracing)
+                REQUIRE((value.minCoeff() >= 0.f && value.maxCoeff() <= 1.f));
+            sum += value;
+        }
+        render.integrator = {};
+        return Eigen::Vector3f(sum / (float) tasks.size());
+    };
+
+    SECTION("预览的结果在 [0, 1] 之间")
+    {
+        REQUIRE(average(IntegratorType::AmbientOcclusion).norm() > 0.f);
+        REQUIRE(average(IntegratorType::Normal).norm() > 0.f);
+        REQUIRE(average(IntegratorType::Albedo).norm() > 0.f);
+        REQUIRE(average(IntegratorType::Depth).norm() > 0.f);
+    }
+
+    SECTION("直接光照比完整的路径追踪暗")
+    {
+        Eigen::Vector3f direct = Eigen::Vector3f::Zero();
+        Eigen::Vector3f full = Eigen::Vector3f::Zero();
+        LOOP(16)
+        {
+            direct += average(IntegratorType::DirectLighting);
+            full += average(IntegratorType::PathTracing);
+        }
+        REQUIRE(luminance(direct) < luminance(full));
+    }
+
+    SECTION("通过 render_* 的入口选择预览的积分器")
+    {
+        render.integrator.type = IntegratorType::Normal;
+        render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+        render.integrator = {};
+
+        // 摄像机看到的第一个交点的法线
+        for (auto &task : tasks)
+        {
+            auto inter = scene->intersect(task.ray);
+            auto pixel = render.framebuffer[task.row * 16 + task.col];
+            auto expected = RTRender::gamma_correct(
+                    inter.happened() ? Eigen::Vector3f((inter.normal().get() + Eigen::Vector3f::Ones()) * 0.5f)
+                                     : Eigen::Vector3f::Zero());
+            REQUIRE(pixel == expected);
+        }
+    }
+}
+
+TEST_CASE("Instant Radiosity")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto tall_box = MeshTriangle::mesh_load(PATH_CORNELL_TALLBOX)[0];
+    tall_box->mat()->set_diffuse(color_cornel_white);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16,
+                                         16,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(tall_box);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render;
+
+    // 路径追踪的参考值
+    render.init(scene, 256, 1);
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    float reference = 0.f;
+    for (auto &c : render.radiance_buffer)
+        reference += luminance(c);
+
+    // 每个 VPL 都在场景的表面上
+    render.init(scene, 1, 1);
+    render.vpl_build();
+    REQUIRE(render.integrator.type == IntegratorType::InstantRadiosity);
+    REQUIRE(render.vpls.size() > (size_t) render.integrator.vpl.light_paths);
+    for (auto &vpl : render.vpls)
+        REQUIRE(scene->bounding_box().contain(vpl.pos));
+
+    render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    auto image = render.radiance_buffer;
+    float estimate = 0.f;
+    for (auto &c : image)
+        estimate += luminance(c);
+    fmt::print("\ninstant radiosity: {}, path tracing: {}\n", estimate, reference);
+
+    SECTION("和路径追踪的结果接近，裁剪会损失一部分能量")
+    {
+        REQUIRE(estimate < reference * 1.1f);
+        REQUIRE(estimate > reference * 0.7f);
+    }
+
+    SECTION("没有噪声：增加 spp 不会改变结果")
+    {
+        render._spp = 4;
+        render.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+        for (size_t i = 0; i < image.size(); ++i)
+            REQUIRE(render.radiance_buffer[i].isApprox(image[i]));
+    }
+
+}
+
+TEST_CASE("修改材质之后重新着色")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto tall_box = MeshTriangle::mesh_load(PATH_CORNELL_TALLBOX)[0];
+    tall_box->mat()->set_diffuse(color_cornel_white);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16,
+                                         16,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(tall_box);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render;
+    render.integrator.light_sampling = GENERATE(LightSampling::NEE, LightSampling::MIS);
+
+    render.init(scene, 8, 3);
+    auto results = render.render_to_memory(4);
+    REQUIRE(results.size() == 16 * 16);
+
+    // 材质不变时，重新着色得到相同的结果
+    auto radiance = render.radiance_buffer;
+    render.reshade(results, 4);
+    for (size_t i = 0; i < radiance.size(); ++i)
+        REQUIRE(render.radiance_buffer[i].isApprox(radiance[i], 1e-4f));
+
+    // 修改材质之后，和使用新材质重新渲染的结果相同：光路的采样和材质的参数无关
+    left->mat()->set_diffuse(Eigen::Vector3f(0.1f, 0.2f, 0.8f));
+    light->mat()->set_emission(color_cornel_light * 0.5f);
+    render.reshade(results, 4);
+    auto reshaded = render.radiance_buffer;
+
+    render.init(scene, 8, 3);
+    render.render_to_memory(4);
+    float diff = 0.f;
+    for (size_t i = 0; i < reshaded.size(); ++i)
+    {
+        REQUIRE(render.radiance_buffer[i].isApprox(reshaded[i], 1e-3f));
+        diff += (reshaded[i] - radiance[i]).norm();
+    }
+    REQUIRE(diff > 0.f);
+
+}
+
+TEST_CASE("只记录离群的采样")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto tall_box = MeshTriangle::mesh_load(PATH_CORNELL_TALLBOX)[0];
+    tall_box->mat()->set_diffuse(color_cornel_white);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(16,
+                                         16,
+                                         40.f,
+                                         Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(tall_box);
+    scene->obj_add(light);
+    scene->build();
+    RTRender render(scene, 32, 5);
+    auto tasks = RTRender::_prepare_render_task(scene);
+
+    SECTION("统计信息和离群采样的光路")
+    {
+        render.outlier_criteria.k_sigma = 3.f;
+        int sample_cnt = 0, outlier_cnt = 0;
+        for (auto &task : tasks)
+        {
+            auto res = render.jobRenderOutliers(task);
+            auto all = render.jobRenderOnePixel<RadianceOnly>(task);
+            REQUIRE(res->radiance.isApprox(all->radiance, 1e-5f));
+            REQUIRE(res->stat.spp == 32);
+            REQUIRE(res->stat.nonfinite_cnt == 0);
+            REQUIRE(res->path_list.size() == res->stat.outliers.size());
+
+            // 均值和所有采样的亮度均值相同
+            float mean = 0.f;
+            for (auto &path : all->path_list)
+                mean += luminance(path.front().Lo) / 32.f;
+            REQUIRE(res->stat.lum_mean == Approx(mean).margin(1e-4));
+
+            // 离群采样的光路和重建的光路相同，亮度确实偏离了其他采样的均值
+            for (size_t k = 0; k < res->stat.outliers.size(); ++k)
+            {
+                int sample = res->stat.outliers[k];
+                auto path = render.reconstruct_path(task.col, task.row, sample);
+                REQUIRE(path.size() == res->path_list[k].size());
+                REQUIRE(path.front().Lo == res->path_list[k].front().Lo);
+                float lum = luminance(path.front().Lo);
+                float mean_others = (res->stat.lum_mean * 32.f - lum) / 31.f;
+                REQUIRE(std::abs(lum - mean_others) > render.outlier_criteria.min_deviation * 0.999f);
+            }
+            sample_cnt += 32;
+            outlier_cnt += (int) res->stat.outliers.size();
+        }
+        fmt::print("\noutliers: {}/{}\n", outlier_cnt, sample_cnt);
+        REQUIRE(outlier_cnt > 0);
+        REQUIRE(outlier_cnt * 20 < sample_cnt);
+    }
+
+    SECTION("radiance 不是有限值的采样一定会被记录")
+    {
+        light->mat()->set_emission(Eigen::Vector3f::Constant(std::numeric_limits<float>::quiet_NaN()));
+        int nonfinite_cnt = 0;
+        for (auto &task : tasks)
+        {
+            auto res = render.jobRenderOutliers(task);
+            REQUIRE(res->stat.nonfinite_cnt <= (int) res->stat.outliers.size());
+            for (auto &path : res->path_list)
+                nonfinite_cnt += !path.front().Lo.allFinite();
+            REQUIRE(std::isfinite(res->stat.lum_mean));
+        }
+        REQUIRE(nonfinite_cnt > 0);
+    }
+
+}
+
+
+TEST_CASE("多个渲染实例同时渲染")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景，另一个视角共享同一个 BVH
+    auto scene = std::make_shared<Scene>(20, 20, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    auto scene_side = scene->view(16, 24, 50.f, Eigen::Vector3f{0.2f, 0.f, 1.f},
+                                  Eigen::Vector3f{150.f, 273.f, -600.f});
+    REQUIRE(&scene_side->bounding_box() == &scene->bounding_box());
+
+    // 依次渲染，作为参考
+    RTRender front(scene, 4, 1), side(scene_side, 4, 2);
+    front.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    side.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+
+    // 两个实例在不同的线程中同时渲染，结果和依次渲染相同
+    RTRender front_2(scene, 4, 1), side_2(scene_side, 4, 2);
+    std::thread thread([&]() {
+        front_2.render_atomic("", 8, RTRender::TileOrder::Hilbert, RTRender::CaptureMode::None);
+    });
+    side_2.render_atomic("", 8, RTRender::TileOrder::Scanline, RTRender::CaptureMode::None);
+    thread.join();
+    REQUIRE(front_2.radiance_buffer == front.radiance_buffer);
+    REQUIRE(front_2.framebuffer == front.framebuffer);
+    REQUIRE(side_2.radiance_buffer == side.radiance_buffer);
+}
+
+
+TEST_CASE("保存进度，继续渲染和增加采样")
+{
+    // 导入模型
+    auto floor = MeshTriangle::mesh_load(PATH_CORNELL_FLOOR)[0];
+    floor->mat()->set_diffuse(color_cornel_white);
+    auto left = MeshTriangle::mesh_load(PATH_CORNELL_LEFT)[0];
+    left->mat()->set_diffuse(color_cornel_red);
+    auto right = MeshTriangle::mesh_load(PATH_CORNELL_RIGHT)[0];
+    right->mat()->set_diffuse(color_cornel_green);
+    auto light = MeshTriangle::mesh_load(PATH_CORNELL_LIGHT)[0];
+    light->mat()->set_emission(color_cornel_light);
+
+    // 构建场景
+    auto scene = std::make_shared<Scene>(20, 20, 40.f, Eigen::Vector3f{0.f, 0.f, 1.f},
+                                         Eigen::Vector3f{278.f, 273.f, -800.f});
+    scene->obj_add(floor);
+    scene->obj_add(left);
+    scene->obj_add(right);
+    scene->obj_add(light);
+    scene->build();
+    const std::string checkpoint = std::string(RT_RES) + ".checkpoint";
+    std::remove(checkpoint.c_str());
+
+    // 一次完成的渲染，作为参考
+    RTRender reference(scene, 8, 3);
+    REQUIRE(reference.render_resumable("") == 20 * 20 * 8);
+
+    // 先渲染 4 spp 并保存进度
+    {
+        RTRender render(scene, 4, 3);
+        REQUIRE(render.render_resumable(checkpoint) == 20 * 20 * 4);
+    }
+
+    SECTION("从进度继续渲染：已经完成的渲染不会重复追踪")
+    {
+        RTRender render(scene, 1, 3);
+        REQUIRE(render.render_resumable(checkpoint) == 0);
+        REQUIRE(render._spp == 4);
+    }
+
+    SECTION("增加采样之后，和一次完成的渲染相同")
+    {
+        RTRender render(scene, 1, 3);
+        REQUIRE(render.render_more(checkpoint, 4) == 20 * 20 * 4);
+        REQUIRE(render.radiance_buffer == reference.radiance_buffer);
+        REQUIRE(render.framebuffer == reference.framebuffer);
+
+        // 进度文件中的 spp 也更新了
+        RTRender resumed(scene, 1, 3);
+        REQUIRE(resumed.checkpoint_load(checkpoint));
+        REQUIRE(resumed._spp == 8);
+    }
+
+    SECTION("中途中断：部分像素的采样数不足")
+    {
+        RTRender render(scene, 8, 3);
+        REQUIRE(render.checkpoint_load(checkpoint));
+        render._spp = 8;
+        for (int row = 0; row < 10; ++row)
+            for (int col = 0; col < 20; ++col)
+            {
+                // 上半部分的像素已经完成，和参考渲染相同
+                render.film.at(row, col) = reference.film.at(row, col);
+            }
+        render.checkpoint_save(checkpoint);
+
+        RTRender resumed(scene, 1, 3);
+        REQUIRE(resumed.render_resumable(checkpoint) == 10 * 20 * 4);
+        REQUIRE(resumed.radiance_buffer == reference.radiance_buffer);
+    }
+
+    SECTION("render_id 不一致时不能恢复")
+    {
+        RTRender render(scene, 8, 4);
+        REQUIRE_THROWS(render.render_resumable(checkpoint));
+    }
+
+    std::remove(checkpoint.c_str());
+}
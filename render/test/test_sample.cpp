@@ -60,6 +60,41 @@ TEST_CASE("半球均匀采样") {
 }
 
 
+TEST_CASE("BSDF 采样") {
+    Direction N({4, 5, 8});
+
+    SECTION("漫反射材质按照余弦加权采样") {
+        auto mat = std::make_shared<Material>();
+        Direction wo({1, 2, 3});
+
+        // 余弦加权时，cos(theta) 的期望是 2/3
+        float cos_sum = 0.f;
+        int cnt = 10000;
+        LOOP(cnt) {
+            auto [wi, pdf, f] = mat->sample(wo, N);
+            float cos_theta = wi.get().dot(N.get());
+
+            REQUIRE(cos_theta > 0.f);
+            REQUIRE(std::abs(1.f - wi.get().norm()) < epsilon_4);
+            REQUIRE(pdf == Approx(cos_theta / M_PI).margin(epsilon_4));
+            REQUIRE(pdf == Approx(mat->pdf(wi, wo, N)).margin(epsilon_4));
+            REQUIRE(f == mat->brdf_phong(wi, wo, N));
+            cos_sum += cos_theta;
+        }
+        REQUIRE(cos_sum / (float) cnt == Approx(2.f / 3.f).epsilon(0.02f));
+
+        // 表面下方的方向不会被采样到
+        REQUIRE(mat->pdf(-N, wo, N) == 0.f);
+    }
+
+    SECTION("发光体不会反射光线") {
+        Material mat(Material::MaterialType::Emission, color_cornel_light);
+        REQUIRE(mat.sample(N, N).pdf == 0.f);
+        REQUIRE(mat.pdf(N, N, N) == 0.f);
+    }
+}
+
+
 // =========================================================
 // 这个测试用例只能保证 BVH 的采样基本可用
 // =========================================================
@@ -122,3 +122,32 @@ TEST_CASE("写入一个像素对应的多条光路（包括 node 和 path）-使
     DB::close_db();
 }
 
+
+TEST_CASE("写入像素的统计信息") {
+    /* 连接数据库 */
+    DB::init_db(DB_PATH);
+
+    /* 旧的数据库中可能没有这张表 */
+    PixelStatSerialize::createTable(DB::db);
+    PixelStatSerialize::deleteTable(DB::db);
+
+    /* 写入 */
+    PixelStat stat;
+    stat.spp = 16;
+    stat.lum_mean = 0.5f;
+    stat.lum_std = 0.1f;
+    stat.outliers = {3, 7};
+    PixelStatSerialize::insertStat(DB::db, 40, 50, stat);
+
+    /* 读出离群采样的序号 */
+    std::string samples;
+    sqlite3_exec(DB::db, "SELECT outlier_samples FROM pixel_stat", [](void *data, int, char **values, char **) {
+        *static_cast<std::string *>(data) = values[0];
+        return 0;
+    }, &samples, nullptr);
+    REQUIRE(samples == "3 7 ");
+
+    /* 关闭数据库 */
+    DB::close_db();
+}
+
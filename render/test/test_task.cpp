@@ -63,3 +63,36 @@ TEST_CASE("worker") {
     }
 }
 
+
+
+TEST_CASE("线程池和 parallel_for") {
+    SECTION("submit 的任务都会执行") {
+        ThreadPool pool(4);
+        std::atomic<int> sum{0};
+        std::vector<std::future<void>> futures;
+        for (int i = 0; i < 1000; ++i)
+            futures.push_back(pool.submit([&sum, i]() { sum += i; }));
+        for (auto &f : futures)
+            f.wait();
+        REQUIRE(sum == 999 * 1000 / 2);
+    }
+
+    SECTION("多个线程同时调用 parallel_for，并且嵌套调用") {
+        const size_t n = 256;
+        std::vector<std::vector<int>> res(8, std::vector<int>(n * n, 0));
+        std::vector<std::thread> threads;
+        for (auto &buffer : res) {
+            threads.emplace_back([&buffer, n]() {
+                parallel_for(n, 8, 4, [&](size_t i) {
+                    parallel_for(n, 8, 16, [&](size_t j) { buffer[i * n + j] += 1; });
+                });
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+
+        for (auto &buffer : res)
+            for (int v : buffer)
+                REQUIRE(v == 1);
+    }
+}
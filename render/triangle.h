@@ -49,9 +49,24 @@ public:
     /* 计算三角形和光线的交点 */
     Intersection intersect(const Ray &ray) override;
 
+    /* 光线在 (0, t_max) 范围内是否和三角形相交 */
+    bool occluded(const Ray &ray, float t_max) override;
+
     /* 在物体内随机采样 */
     Intersection obj_sample(float area_threshold) override;
 
+    /* 计算三角形和光线包的交点，所有光线同时计算 */
+    void intersect_packet(const RayPacket<4> &packet, uint32_t mask, PacketHit<4> &hit) override;
+
+    void intersect_packet(const RayPacket<8> &packet, uint32_t mask, PacketHit<8> &hit) override;
+
+private:
+    template<int N_>
+    void _intersect_packet(const RayPacket<N_> &packet, uint32_t mask, PacketHit<N_> &hit);
+
+    /* Moller Trumbore 算法：光线和三角形是否相交，相交时将距离写入 t_near */
+    bool _hit(const Ray &ray, float &t_near) const;
+
 private:
     Eigen::Vector3f _a, _b, _c;     /* 三角形三个顶点的坐标 */
     Direction _normal;              /* 三角形的面法线 */
@@ -73,11 +88,15 @@ public:
     // 根据 Assimp 生成模型
     // =========================================================
     // 从模型文件中载入模型，一个文件有多个 node，一个 node 有多个 mesh，树形结果
-    static std::vector<std::shared_ptr<MeshTriangle>> mesh_load(const std::string &file_name);
+    // method 是每个模型内部的 BVH 的构建方式
+    static std::vector<std::shared_ptr<MeshTriangle>> mesh_load(const std::string &file_name,
+                                                                BVHBuildMethod method = BVHBuildMethod::Median);
 
-    static std::vector<std::shared_ptr<MeshTriangle>> process_ainode(const aiNode &node, const aiScene &scene);
+    static std::vector<std::shared_ptr<MeshTriangle>> process_ainode(const aiNode &node, const aiScene &scene,
+                                                                     BVHBuildMethod method = BVHBuildMethod::Median);
 
-    static std::shared_ptr<MeshTriangle> process_aimesh(const aiMesh &mesh);
+    static std::shared_ptr<MeshTriangle> process_aimesh(const aiMesh &mesh,
+                                                        BVHBuildMethod method = BVHBuildMethod::Median);
 
 
     /* 构造函数 */
@@ -96,6 +115,25 @@ public:
         return this->bvh->intersect(ray);
     }
 
+    /* 光线在 (0, t_max) 范围内是否和模型相交 */
+    inline bool occluded(const Ray &ray, float t_max) override {
+        return this->bvh->occluded(ray, t_max);
+    }
+
+    /* 计算模型和光线包的交点 */
+    inline void intersect_packet(const RayPacket<4> &packet, uint32_t mask, PacketHit<4> &hit) override {
+        this->bvh->intersect(packet, mask, hit);
+    }
+
+    inline void intersect_packet(const RayPacket<8> &packet, uint32_t mask, PacketHit<8> &hit) override {
+        this->bvh->intersect(packet, mask, hit);
+    }
+
+    /* 求交的代价就是内部 BVH 的 SAH 代价 */
+    [[nodiscard]] inline float intersect_cost() const override {
+        return this->bvh->sah_cost();
+    }
+
 
 private:
     std::shared_ptr<BVH> bvh;           /* 三角形模型由众多三角形组成，以 BVH 建立加速架构 */
@@ -3,7 +3,9 @@
 #define RENDER_DEBUG_UTILS_H
 
 #include <cmath>
-#include <random>
+#include <atomic>
+#include <cstdint>
+#include <utility>
 
 #include <Eigen/Eigen>
 
@@ -27,14 +29,69 @@ const inline float epsilon_38 = std::numeric_limits<float>::min();
 
 
 
-// [0, 1] 均匀分布的 float
+/**
+ * PCG32 随机数发生器，状态只有 64 位，重新设置种子的代价很低
+ * 参考：https://www.pcg-random.org
+ */
+class Pcg32 {
+public:
+    explicit Pcg32(uint64_t seed = 0) { seed_set(seed); }
+
+    inline void seed_set(uint64_t seed) {
+        _state = 0;
+        next_u32();
+        _state += seed;
+        next_u32();
+    }
+
+    inline uint32_t next_u32() {
+        uint64_t old = _state;
+        _state = old * 6364136223846793005ull + INC;
+        auto xorshifted = (uint32_t) (((old >> 18u) ^ old) >> 27u);
+        auto rot = (uint32_t) (old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31u));
+    }
+
+    // [0, 1) 均匀分布的 float，使用高 24 位，保证结果严格小于 1
+    inline float next_float() { return (float) (next_u32() >> 8) * (1.f / 16777216.f); }
+
+private:
+    static constexpr uint64_t INC = 1442695040888963407ull;
+    uint64_t _state = 0;
+};
+
+
+// 当前线程的随机数发生器，初始种子是固定的：渲染的结果只由采样的种子决定，和线程的数量、调度无关
+// 追踪每个采样之前都要用 random_seed_set 设置种子，否则得到的随机数取决于这个线程之前做过什么
+inline Pcg32 &random_engine() {
+    thread_local Pcg32 engine(0);
+    return engine;
+}
+
+
+// 重新设置当前线程的随机数种子，之后这个线程得到的随机数序列是确定的
+inline void random_seed_set(uint64_t seed) { random_engine().seed_set(seed); }
+
+
+// [0, 1) 均匀分布的 float
 inline float random_float_get()
 {
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    return random_engine().next_float();
+}
+
 
-    return dist(rng);
+// splitmix64 的混合函数，输入的微小差异会扩散到所有的位
+inline uint64_t hash_mix_64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+
+// 一个采样的种子，由像素索引、采样序号和渲染的 id 唯一确定
+inline uint64_t sample_seed_get(uint32_t pixel, uint32_t sample, uint32_t render_id) {
+    return hash_mix_64(hash_mix_64(((uint64_t) render_id << 32) | pixel) ^ sample);
 }
 
 
@@ -54,6 +111,68 @@ inline Eigen::Vector3f random_point_get(float min, float max) {
 }
 
 
+// 原子地给 float 加上一个值：C++17 的 std::atomic<float> 没有 fetch_add，使用 CAS 循环
+inline void atomic_float_add(std::atomic<float> &target, float value) {
+    float old = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(old, old + value, std::memory_order_relaxed)) {}
+}
+
+
+// 颜色的亮度（Rec. 709）
+inline float luminance(const Eigen::Vector3f &color) {
+    return 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+}
+
+
+// 将一个 10 位的整数按位展开，相邻的两位之间插入两个 0
+inline uint32_t morton_expand_bits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+
+// 三维的 Morton 码，每个分量的范围是 [0, 1024)
+inline uint32_t morton_encode_3d(uint32_t x, uint32_t y, uint32_t z) {
+    return (morton_expand_bits(x) << 2) | (morton_expand_bits(y) << 1) | morton_expand_bits(z);
+}
+
+
+// 二维的 Morton 码，每个分量的范围是 [0, 65536)
+inline uint32_t morton_encode_2d(uint32_t x, uint32_t y) {
+    auto expand = [](uint32_t v) {
+        v = (v | (v << 8)) & 0x00FF00FFu;
+        v = (v | (v << 4)) & 0x0F0F0F0Fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return (expand(y) << 1) | expand(x);
+}
+
+
+// 二维 Hilbert 曲线上的序号，n 是网格的边长，必须是 2 的幂，x 和 y 的范围是 [0, n)
+inline uint32_t hilbert_index_2d(uint32_t n, uint32_t x, uint32_t y) {
+    uint32_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // 旋转象限，使子曲线的方向正确
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+
 // 一个花括号作用域，可以通过 break 跳出
 #define RUN_ONCE for(int __u_n_i_q_u_e__v_a_r__ = 1; __u_n_i_q_u_e__v_a_r__ > 0; __u_n_i_q_u_e__v_a_r__--)
 
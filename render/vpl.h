@@ -0,0 +1,48 @@
+#ifndef RENDER_DEBUG_VPL_H
+#define RENDER_DEBUG_VPL_H
+
+#include <vector>
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "ray.h"
+#include "scene.h"
+
+
+/**
+ * 虚拟点光源（VPL）：光源子路径上的一个节点
+ * 节点处的漫反射表面把到达的能量向半球内反射，就像一个点光源
+ */
+struct VPL {
+    Eigen::Vector3f pos{0.f, 0.f, 0.f};
+    Direction normal;                           /* 只向法线一侧的半球发光 */
+    Eigen::Vector3f weight{0.f, 0.f, 0.f};      /* 到达的能量乘以节点处的 BRDF，再除以光源子路径的数量 */
+};
+
+
+/**
+ * Instant Radiosity：从光源出发追踪若干条子路径，在路径的每个节点放置一个 VPL
+ * 着色时，交点处的光照是所有可见的 VPL 的贡献之和，没有随机性，得到平滑的全局光照近似
+ *  - 只支持漫反射材质，VPL 的 BRDF 和入射方向无关，可以预先乘到 weight 中
+ *  - 距离很近时几何项会发散，导致亮斑：把距离限制在 min_distance 以上（会损失一部分近距离的能量）
+ * 参考：Keller 1997, Instant Radiosity
+ */
+class InstantRadiosity {
+public:
+    struct Options {
+        int light_paths = 256;      /* 光源子路径的数量 */
+        int max_bounces = 3;        /* 子路径在场景中弹射的最多次数，0 表示只有光源上的 VPL */
+        float min_distance = 0.f;   /* 几何项中距离的下限，<= 0 表示场景包围盒对角线长度的 1/20 */
+    };
+
+    /**
+     * 生成 VPL：光源上的 VPL 来自 Scene::sample_light，之后按照余弦加权的方向弹射
+     * 每条子路径的随机数种子由子路径的序号和 render_id 决定，相同的参数总是得到相同的 VPL
+     * @param offset 光线原点沿法线的偏移，防止与自身相交
+     */
+    static std::vector<VPL> generate(const Scene &scene, const Options &options, float offset, uint32_t render_id);
+};
+
+
+#endif //RENDER_DEBUG_VPL_H
@@ -0,0 +1,11 @@
+create table pixel_stat
+(
+    row             integer,
+    col             integer,
+    spp             integer,
+    lum_mean        real,
+    lum_std         real,
+    nonfinite_cnt   integer,
+    outlier_cnt     integer,
+    outlier_samples text
+);